@@ -0,0 +1,37 @@
+#ifndef AST_H
+#define AST_H
+
+#include <stddef.h>
+#include "lexer.h"
+
+enum {
+    AST_CMD,        // a simple command: words and redirections
+    AST_SUBSHELL,   // ( list ), with redirections after the )
+    AST_PIPE,       // stages joined by |
+    AST_AND,        // left && right
+    AST_OR,         // left || right
+    AST_SEQ,        // left ; right
+    AST_BG,         // left &
+};
+
+/* Nodes refer to each other and to the line's tokens by index, so the
+ * node array can grow while parsing and is reused from line to line. */
+typedef struct {
+    int    kind;
+    int    left, right;     // operands; AST_PIPE: first stage, AST_SUBSHELL: body
+    int    next;            // AST_CMD, AST_SUBSHELL: next stage of the pipeline, or -1
+    int    tok, ntok;       // AST_CMD: its tokens; AST_SUBSHELL: those after the )
+    int    timed;           // AST_PIPE: prefixed with `time`
+    size_t src, src_end;    // the node's text in the line
+} ast_node;
+
+typedef struct {
+    ast_node *node;
+    int       n, cap;
+} ast;
+
+/* Parse the tokens of one line. Returns the root node, or -1 after
+ * reporting a syntax error. */
+int ast_parse(ast *t, const linetok *lt);
+
+#endif // AST_H
@@ -0,0 +1,18 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+/* A builtin runs with the stage's descriptors already in place (in the
+ * shell, or in a forked child for pipelines and background jobs) and
+ * returns its exit status. Output goes through stdout/stderr. */
+typedef int (*builtin_fn)(int argc, char **argv);
+
+int builtin_cat(int argc, char **argv);
+int builtin_cat_takes(int argc, char **argv);     // 0: options only the external cat has
+int builtin_echo(int argc, char **argv);
+int builtin_printf(int argc, char **argv);
+int builtin_pwd(int argc, char **argv);
+int builtin_test(int argc, char **argv);
+int builtin_true(int argc, char **argv);
+int builtin_false(int argc, char **argv);
+
+#endif // BUILTINS_H
@@ -3,16 +3,8 @@
 #ifndef EXTERNAL_COMMAND_EXECUTION_H
 #define EXTERNAL_COMMAND_EXECUTION_H 
 
-#define MAX_JOBS 10
 #define CMDLINE_MAX 200
 
-typedef struct {
-    int job_no;
-    pid_t pid;
-    int active;  // 1 = running, 0 = finished
-    char cmdline[CMDLINE_MAX];
-} Job;
-
 void run_command(const char *command_path, char *const argv[], int isBackgroundProcess);
 void run_command_with_redirection(char* command_path, char *const argv[], char *file_in, char *file_out, int isBackgroundProcess);
 void check_finished_jobs(void);
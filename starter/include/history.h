@@ -0,0 +1,40 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+#define HISTSIZE_DEFAULT   1000
+#define HISTFILE_DEFAULT   ".shell_history"    // under $HOME
+#define HIST_SYNC_BATCH    32                  // appends between fdatasync()s
+#define ISEARCH_MAX        256                 // query bytes and undo steps
+
+enum { ISEARCH_MORE, ISEARCH_ACCEPT, ISEARCH_ABORT, ISEARCH_PASS };
+
+typedef struct {
+    char     query[ISEARCH_MAX];
+    size_t   len;
+    unsigned match;         // entry shown, 0 = none yet
+    int      failing;       // the query has no (older) match
+    struct {
+        unsigned len, match;
+        int      failing;
+    } trail[ISEARCH_MAX];   // state before each key, for backspace
+    int      depth;
+} isearch;
+
+void        history_init(int persist);
+void        history_add(const char *line, size_t len);
+void        history_clear(void);
+void        history_sync(void);
+
+unsigned    history_first(void);
+unsigned    history_last(void);
+unsigned    history_session_count(void);
+const char *history_get(unsigned n, size_t *len);
+unsigned    history_search_prefix(const char *prefix, size_t len);
+unsigned    history_search(const char *q, size_t qlen, unsigned before);
+void        isearch_begin(isearch *s);
+int         isearch_key(isearch *s, int c);
+int         history_expand(const char *line, size_t len, char **out, size_t *out_len);
+
+#endif // HISTORY_H
@@ -0,0 +1,62 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <time.h>
+
+enum { JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+
+// Resource accounting for one pipeline stage, filled in when it is reaped
+typedef struct {
+    struct timespec start;  // set by the caller at launch
+    struct timespec end;    // CLOCK_MONOTONIC at reap
+    struct rusage   ru;     // from wait4()
+    int             reaped;
+} stage_usage;
+
+typedef struct {
+    int    job_no;
+    pid_t  pgid;            // process group holding every stage, 0 = shell's own
+    pid_t  pid;             // PID of the *last* process in pipeline
+    int    nlive;           // stages not yet reaped
+    int    nstopped;        // live stages currently stopped
+    int    status;          // wait status of the last process, once reaped
+    int    stop_status;     // wait status of the stop that suspended the job
+    int    state;           // JOB_RUNNING, JOB_STOPPED or JOB_DONE
+    int    waited;          // the shell is blocked on it; finishing is not announced
+    int    notify;          // state changed, notice not printed yet
+    int    has_tmodes;
+    struct termios tmodes;  // terminal modes saved when it was suspended
+    stage_usage *usage;     // caller-owned, one per stage, or NULL
+    size_t cmd_off;         // cmdline in the job table's string arena
+} Job;
+
+int   jobs_init_control(int tty_fd, sigset_t *ignored);
+int   jobs_control(void);
+void  jobs_drop_control(void);
+void  jobs_set_notify(int on);
+
+Job  *job_add(pid_t pgid, const pid_t *pids, int npids, const char *cmdline, int foreground);
+Job  *job_by_pid(pid_t pid);
+Job  *job_by_number(int job_no);
+Job  *job_current(void);
+const char *job_cmdline(const Job *j);
+int   jobs_live_procs(void);
+
+void  job_child_status(pid_t pid, int status, const struct rusage *ru);
+void  jobs_reap(void);
+void  jobs_set_tick(void (*fn)(void *), void *arg, int interval_ms);
+int   job_wait(Job *j);
+int   job_foreground(Job *j, int cont);
+int   job_background(Job *j);
+void  jobs_hangup_stopped(void);
+void  jobs_wait_all(void);
+int   jobs_pending_notices(void);
+int   jobs_print_notices(void);
+void  jobs_print(void);
+
+#endif // JOBS_H
@@ -0,0 +1,49 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+#define LAUNCH_INLINE_ACTIONS 16
+
+typedef enum {
+    LAUNCH_FORK,    // fork() + dup2() + execv()
+    LAUNCH_SPAWN    // posix_spawn() with file actions
+} launch_engine;
+
+enum { LAUNCH_DUP2, LAUNCH_CLOSE };
+
+/* Descriptor setup done in the child before exec, applied in order.
+ * Mirrors posix_spawn_file_actions so both engines share one description. */
+typedef struct {
+    int op;     // LAUNCH_DUP2 or LAUNCH_CLOSE
+    int fd;     // descriptor being set up in the child
+    int src;    // LAUNCH_DUP2: descriptor copied onto fd
+} launch_action;
+
+/* Actions live in inline_act until a long pipeline needs more; then act
+ * moves to the heap and launch_spec_free() releases it. */
+typedef struct {
+    launch_action *act;
+    int nact, cap;
+    launch_action inline_act[LAUNCH_INLINE_ACTIONS];
+    pid_t pgid;     // -1 = stay in the shell's group, 0 = lead a new one, else join
+    int tty_fd;     // >= 0: the child's group takes this terminal (fork engine)
+} launch_spec;
+
+void launch_spec_init(launch_spec *ls);
+void launch_spec_free(launch_spec *ls);
+int  launch_dup2(launch_spec *ls, int src, int fd);
+int  launch_close(launch_spec *ls, int fd);
+
+pid_t launch_process(const char *path, char *const argv[], const launch_spec *ls);
+int   launch_pipe(int fds[2], int size);
+int   launch_pipe_size(int fd);
+pid_t launch_function(int (*fn)(int, char **), int argc, char **argv, const launch_spec *ls);
+
+void launch_init(void);
+void launch_set_sigdefault(const sigset_t *set);
+void launch_set_engine(launch_engine e);
+launch_engine launch_get_engine(void);
+
+#endif // LAUNCH_H
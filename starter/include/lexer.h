@@ -3,16 +3,58 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
-/* A simple NULL-terminated token array with a size counter. */
+void reader_init(int fd);
+void reader_set_wait(int (*fn)(int fd));
+int  reader_wait_readable(int fd);
+char *read_line(size_t *len);
+
+/* Control operators; anything else is a word (TOK_WORD). Redirections
+ * such as 2>&1, &>f and >|f stay words for redir_parse(). */
+enum { TOK_WORD, TOK_SEMI, TOK_AMP, TOK_PIPE, TOK_AND, TOK_OR, TOK_LPAREN, TOK_RPAREN };
+
+enum { EXP_VAR, EXP_HOME, EXP_CMD };
+
+/* A $NAME, ${NAME}, $(command) or leading ~ of a word, replaced when the
+ * word is expanded. The name or command stays in the line copy at the
+ * start of the arena. */
 typedef struct {
-    char **items;  /* items[size] is guaranteed to be NULL */
-    size_t size;   /* number of actual tokens (not counting the NULL) */
-} tokenlist;
+    size_t at;          /* offset in the word where the value goes */
+    size_t name, name_len;
+    int    kind;        /* EXP_* */
+    int    quoted;      /* inside "..." */
+} expansion;
 
-char *get_input(void);
-tokenlist *get_tokens(char *input);
+/* Tokens of one line as (offset, length) spans into a single arena. Quotes
+ * and backslashes are already removed from a word's text. */
+typedef struct {
+    size_t off;
+    size_t len;
+    int    op;          /* TOK_* */
+    int    quoted;      /* some part was quoted or escaped */
+    size_t lit;         /* leading bytes typed as is: no quote, escape or $ */
+    size_t exp, nexp;   /* its expansions in linetok.exps, until expanded */
+    int    glob;        /* an unquoted * ? or [: a pattern for pathname expansion */
+    unsigned qm, nqm;   /* its quoted * ? [ ] in linetok.qmeta (kept small: spans are copied) */
+    size_t src, src_end;    /* where the token was in the line */
+} span;
+
+typedef struct {
+    char   *arena;      /* line copy + tokens + appended expansions */
+    size_t  used, cap;
+    span   *spans;
+    expansion *exps;
+    size_t  nexps, exp_cap;
+    size_t *qmeta;      /* offsets in their word of metacharacters that were quoted */
+    size_t  nqmeta, qmeta_cap;
+    span   *fields;     /* expand_words() output: the words to run */
+    char  **field_items;    /* filled by line_fields(), NULL-terminated */
+    size_t  nfields, field_cap;
+    size_t  size;       /* number of tokens in spans */
+    size_t  span_cap;
+} linetok;
 
-tokenlist *new_tokenlist(void);
-void add_token(tokenlist *tokens, char *item);
-void free_tokens(tokenlist *tokens);
-int tokenize(const char *input, char **tokens, int max_tokens);
+int    tokenize_line(linetok *lt, const char *line, size_t len);
+void   expand_set_command(char *(*run)(const char *cmd, size_t len, size_t *out_len));
+long   expand_words(linetok *lt, size_t from, size_t to);
+char **line_fields(linetok *lt);
+void   free_linetok(linetok *lt);
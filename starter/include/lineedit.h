@@ -0,0 +1,12 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include <stddef.h>
+
+int   lineedit_usable(void);
+void  lineedit_set_builtins(const char *const *names);
+char *lineedit_read(const char *prompt, size_t *len);
+void  lineedit_hide(void);
+int   lineedit_show(void);
+
+#endif // LINEEDIT_H
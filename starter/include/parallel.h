@@ -0,0 +1,13 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/* parallel [-j N] command [args] [::: arg...]: a bounded pool of jobs with
+ * their output kept in argument order. */
+int builtin_parallel(int argc, char **argv);
+
+/* fn returns the read end of the shell's SIGCHLD self-pipe (nonblocking)
+ * for the calling process, or -1; parallel polls it instead of taking
+ * over SIGCHLD itself. */
+void parallel_set_wakeup(int (*fn)(void));
+
+#endif // PARALLEL_H
@@ -1 +1,18 @@
+#ifndef PATH_SEARCH_H
+#define PATH_SEARCH_H
+
 char* search_path(char *command_name);
+
+/* Command-location cache (the `hash` builtin).
+ * path_hash_lookup() returns the absolute path for cmd, or NULL if it is
+ * not found; the pointer stays valid until the next cache call. */
+const char *path_hash_lookup(const char *cmd);
+int  path_hash_add(const char *cmd);
+void path_hash_clear(void);
+void path_hash_print(void);
+
+/* Completion: executables in PATH starting with prefix, from an index
+ * that re-lists a directory only when its mtime changes. */
+size_t path_complete(const char *prefix, size_t len, char ***out);
+
+#endif // PATH_SEARCH_H
@@ -0,0 +1,21 @@
+#ifndef PATHGLOB_H
+#define PATHGLOB_H
+
+#include <stddef.h>
+
+/* Pathname expansion of one word: `*`, `?`, `[...]` (`[!...]` negates)
+ * in each path component, and `**` as a whole component for any number
+ * of directories. A backslash makes the next character literal; the
+ * lexer escapes quoted metacharacters that way. Returns the number of
+ * matches and sets *out to them, sorted; they stay valid until the next
+ * call. */
+size_t pathglob(const char *pat, char ***out);
+
+/* Directory listings are kept until pathglob_reset(), so several
+ * patterns over one directory read it once. The shell resets before
+ * expanding each pipeline and after each $(...): a listing is never
+ * trusted across a command that could have written to the directory,
+ * since an mtime check misses changes within the timestamp granularity. */
+void pathglob_reset(void);
+
+#endif // PATHGLOB_H
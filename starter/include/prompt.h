@@ -1,5 +1,8 @@
 #ifndef PROMPT_H
 #define PROMPT_H
 
-char * get_prompt();
-#endif // SHELL_H
+void prompt_init(void);
+void prompt_set_cwd(const char *dir);
+void print_prompt(void);
+char * get_prompt(void);
+#endif // PROMPT_H
@@ -0,0 +1,37 @@
+#ifndef REDIR_H
+#define REDIR_H
+
+#include "launch.h"
+
+enum {
+    REDIR_IN,       // n< file
+    REDIR_OUT,      // n> file, truncating
+    REDIR_APPEND,   // n>> file
+    REDIR_DUP,      // n<&m, n>&m
+    REDIR_CLOSE,    // n<&-, n>&-
+    REDIR_STRING,   // n<<< word
+};
+
+typedef struct {
+    int   kind;
+    int   fd;       // descriptor of the command being set up
+    int   src;      // REDIR_DUP: descriptor copied onto fd
+    char *word;     // file name or here-string; points into the line
+    int   opened;   // redir_open(): the file or here-string, else -1
+    int   saved;    // redir_swap_in(): the shell's own fd before the swap
+} Redir;
+
+/* A stage's redirections are applied left to right, so `>f 2>&1` and
+ * `2>&1 >f` differ as in sh. Every file and here-string is opened in the
+ * shell before anything forks, then either handed to the launcher as
+ * dup2/close actions or swapped onto the shell's own descriptors around an
+ * in-process builtin. */
+int  redir_parse(char *tok, size_t lit, char *next, Redir *out, int *used_next);
+int  redir_open(Redir *r, int n);
+void redir_close(Redir *r, int n);
+int  redir_to_launch(const Redir *r, int n, launch_spec *ls);
+int  redir_swap_in(Redir *r, int n);
+void redir_swap_out(Redir *r, int n);
+int  redir_memfd(const char *name);
+
+#endif // REDIR_H
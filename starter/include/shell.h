@@ -2,30 +2,38 @@
 #define SHELL_H
 
 #include <sys/types.h>
+#include "redir.h"
 
-#define MAX_TOKENS   256
-#define MAX_CMDS     3      // supports up to two pipes: cmd1 | cmd2 | cmd3
 #define CMDLINE_MAX  2048
-#define MAX_JOBS     32
 
 typedef struct {
-    char *argv[MAX_TOKENS];
+    int   argv_off;         // index of this stage's argv[0] in Pipeline.argv
     int   argc;
-    char *in_file;          // or NULL
-    char *out_file;         // or NULL
+    int   redir_off;        // this stage's redirections in Pipeline.redir
+    int   nredir;
+    int   subshell;         // ( list ) stage: the list's AST node, else -1
 } Command;
 
+/* Stages of `cmd1 | cmd2 | ... | cmdN`, built from one pipeline of the
+ * line's AST just before it runs. All words live in one growable argv
+ * arena, each stage's run NULL-terminated, so the struct stays small and is
+ * reused from line to line without reallocating. */
 typedef struct {
-    Command cmd[MAX_CMDS];
-    int     ncmd;
-    int     background;     // &
+    char   **argv;          // word arena shared by all stages
+    int      nargv, argv_cap;
+    Command *cmd;
+    int      ncmd, cmd_cap;
+    Redir   *redir;         // redirections of all stages, in order
+    int      nredir, redir_cap;
+    int      background;    // &
 } Pipeline;
 
-typedef struct {
-    int   job_no;
-    pid_t pid;              // PID of the *last* process in pipeline
-    int   active;           // 1 = running, 0 = finished
-    char  cmdline[CMDLINE_MAX];
-} Job;
+static inline char **cmd_argv(const Pipeline *p, int i) {
+    return p->argv + p->cmd[i].argv_off;
+}
+
+static inline Redir *cmd_redir(const Pipeline *p, int i) {
+    return p->redir + p->cmd[i].redir_off;
+}
 
 #endif // SHELL_H
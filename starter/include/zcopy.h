@@ -0,0 +1,16 @@
+#ifndef ZCOPY_H
+#define ZCOPY_H
+
+#include <sys/types.h>
+
+enum { ZCOPY_AUTO, ZCOPY_RW, ZCOPY_SPLICE, ZCOPY_RANGE, ZCOPY_SENDFILE };
+
+/* Copy everything from in (from its current offset) to out. The kernel
+ * moves the data when it can: splice() when either end is a pipe,
+ * copy_file_range() between regular files, sendfile() from a regular file,
+ * and read()/write() otherwise. Returns the bytes copied, or -1 with errno
+ * set (EPIPE when the reader went away). */
+off_t zcopy(int in, int out);
+off_t zcopy_with(int in, int out, int method);
+
+#endif // ZCOPY_H
@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+
+/* Recursive-descent parser for a command line:
+ *
+ *   list     := and_or ((';' | '&') and_or)* [';' | '&']
+ *   and_or   := pipeline (('&&' | '||') pipeline)*
+ *   pipeline := ['time'] stage ('|' stage)*
+ *   stage    := '(' list ')' word* | word+
+ *
+ * A stage's words are only delimited here; they are expanded and split
+ * into argv and redirections when the pipeline runs, so a branch that is
+ * skipped costs nothing past this pass.
+ */
+
+#define AST_MAX_DEPTH 200       // nested ( )
+
+typedef struct {
+    const linetok *lt;
+    ast   *t;
+    size_t i;                   // next token
+    int    depth;
+} parser;
+
+static int op_at(const parser *p, size_t i) {
+    return i < p->lt->size ? p->lt->spans[i].op : -1;
+}
+
+static int peek(const parser *p) {
+    return op_at(p, p->i);
+}
+
+static int syntax_error(const parser *p) {
+    if (p->i < p->lt->size) {
+        fprintf(stderr, "error: syntax error near '%s'\n", p->lt->arena + p->lt->spans[p->i].off);
+    } else {
+        fprintf(stderr, "error: syntax error: unexpected end of line\n");
+    }
+    return -1;
+}
+
+static int new_node(parser *p, int kind, size_t first, size_t last) {
+    ast *t = p->t;
+    if (t->n == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 16;
+        ast_node *nn = realloc(t->node, (size_t)cap * sizeof(*nn));
+        if (!nn) {
+            perror("realloc");
+            return -1;
+        }
+        t->node = nn;
+        t->cap = cap;
+    }
+    ast_node *n = &t->node[t->n];
+    memset(n, 0, sizeof(*n));
+    n->kind = kind;
+    n->left = n->right = n->next = -1;
+    n->src = p->lt->spans[first].src;
+    n->src_end = p->lt->spans[last].src_end;
+    return t->n++;
+}
+
+static int binary(parser *p, int kind, int left, int right) {
+    int n = new_node(p, kind, 0, 0);
+    if (n < 0) return -1;
+    ast_node *nd = &p->t->node[n];
+    nd->left = left;
+    nd->right = right;
+    nd->src = p->t->node[left].src;
+    nd->src_end = p->t->node[right].src_end;
+    return n;
+}
+
+static int parse_list(parser *p);
+
+static int parse_stage(parser *p) {
+    size_t first = p->i;
+    if (peek(p) == TOK_LPAREN) {
+        if (++p->depth > AST_MAX_DEPTH) {
+            fprintf(stderr, "error: ( ) nested too deeply\n");
+            return -1;
+        }
+        p->i++;
+        int body = parse_list(p);
+        if (body < 0) return -1;
+        if (peek(p) != TOK_RPAREN) return syntax_error(p);
+        p->i++;
+        p->depth--;
+        size_t words = p->i;
+        while (peek(p) == TOK_WORD) p->i++;
+        int n = new_node(p, AST_SUBSHELL, first, p->i - 1);
+        if (n < 0) return -1;
+        p->t->node[n].left = body;
+        p->t->node[n].tok = (int)words;
+        p->t->node[n].ntok = (int)(p->i - words);
+        return n;
+    }
+    while (peek(p) == TOK_WORD) p->i++;
+    if (p->i == first) return syntax_error(p);
+    if (peek(p) == TOK_LPAREN) return syntax_error(p);
+    int n = new_node(p, AST_CMD, first, p->i - 1);
+    if (n < 0) return -1;
+    p->t->node[n].tok = (int)first;
+    p->t->node[n].ntok = (int)(p->i - first);
+    return n;
+}
+
+static int parse_pipeline(parser *p) {
+    size_t first = p->i;
+    int timed = 0;
+    const span *sp = &p->lt->spans[p->i];
+    if (peek(p) == TOK_WORD && !sp->quoted && strcmp(p->lt->arena + sp->off, "time") == 0) {
+        timed = 1;
+        p->i++;
+        if (peek(p) != TOK_WORD && peek(p) != TOK_LPAREN) {
+            fprintf(stderr, "usage: time pipeline\n");
+            return -1;
+        }
+    }
+    int head = parse_stage(p);
+    if (head < 0) return -1;
+    int last = head;
+    while (peek(p) == TOK_PIPE) {
+        p->i++;
+        int s = parse_stage(p);
+        if (s < 0) return -1;
+        p->t->node[last].next = s;
+        last = s;
+    }
+    int n = new_node(p, AST_PIPE, first, p->i - 1);
+    if (n < 0) return -1;
+    p->t->node[n].left = head;
+    p->t->node[n].timed = timed;
+    return n;
+}
+
+static int parse_and_or(parser *p) {
+    int left = parse_pipeline(p);
+    while (left >= 0 && (peek(p) == TOK_AND || peek(p) == TOK_OR)) {
+        int kind = peek(p) == TOK_AND ? AST_AND : AST_OR;
+        p->i++;
+        int right = parse_pipeline(p);
+        if (right < 0) return -1;
+        left = binary(p, kind, left, right);
+    }
+    return left;
+}
+
+static int parse_list(parser *p) {
+    int list = -1;
+    for (;;) {
+        int item = parse_and_or(p);
+        if (item < 0) return -1;
+        if (peek(p) == TOK_AMP) {
+            int bg = new_node(p, AST_BG, p->i, p->i);
+            if (bg < 0) return -1;
+            p->t->node[bg].left = item;
+            p->t->node[bg].src = p->t->node[item].src;
+            item = bg;
+        }
+        list = list < 0 ? item : binary(p, AST_SEQ, list, item);
+        if (list < 0) return -1;
+        if (peek(p) != TOK_SEMI && peek(p) != TOK_AMP) return list;
+        p->i++;
+        // a trailing ; or & ends the list
+        if (peek(p) == -1 || peek(p) == TOK_RPAREN) return list;
+    }
+}
+
+int ast_parse(ast *t, const linetok *lt) {
+    parser p = { lt, t, 0, 0 };
+    t->n = 0;
+    if (lt->size == 0) return -1;
+    int root = parse_list(&p);
+    if (root >= 0 && p.i < lt->size) return syntax_error(&p);
+    return root;
+}
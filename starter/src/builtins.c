@@ -0,0 +1,522 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "builtins.h"
+#include "zcopy.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* Utility builtins: the small commands scripts call in loops, run without
+ * a fork+exec. They only read their arguments and the environment and
+ * write through stdio, so the same code serves an in-shell call with its
+ * redirections swapped in and a forked pipeline stage. Behaviour follows
+ * POSIX, with echo's -n/-e/-E as in bash.
+ */
+
+// one backslash escape at *s (past the backslash); returns the byte, -1 for \c
+static int escape(const char **s, int zero_prefixed) {
+    const char *p = *s;
+    int c = *p++;
+    switch (c) {
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case 'c': *s = p; return -1;
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': {
+        // echo -e and %b take \0nnn, a printf format \nnn
+        int digits = 2;
+        if (zero_prefixed) {
+            if (c != '0') {
+                p--;
+                c = '\\';
+                break;
+            }
+            c = 0;
+            digits = 3;
+        } else {
+            c -= '0';
+        }
+        for (int i = 0; i < digits && *p >= '0' && *p <= '7'; i++) c = c * 8 + (*p++ - '0');
+        c &= 0xff;
+        break;
+    }
+    case 'x': {
+        int v = 0, n = 0;
+        for (; n < 2; n++, p++) {
+            int d = *p >= '0' && *p <= '9' ? *p - '0'
+                  : *p >= 'a' && *p <= 'f' ? *p - 'a' + 10
+                  : *p >= 'A' && *p <= 'F' ? *p - 'A' + 10 : -1;
+            if (d < 0) break;
+            v = v * 16 + d;
+        }
+        if (n == 0) {
+            p--;
+            c = '\\';
+        } else {
+            c = v;
+        }
+        break;
+    }
+    case '\0':
+        p--;
+        c = '\\';
+        break;
+    default:
+        // unknown escape: keep the backslash and let the char print next
+        p--;
+        c = '\\';
+        break;
+    }
+    *s = p;
+    return c;
+}
+
+// write s with escapes expanded; returns 1 when \c ended the output
+static int put_escaped(const char *s) {
+    while (*s) {
+        if (*s != '\\') {
+            putchar(*s++);
+            continue;
+        }
+        s++;
+        int c = escape(&s, 1);
+        if (c < 0) return 1;
+        putchar(c);
+    }
+    return 0;
+}
+
+int builtin_echo(int argc, char **argv) {
+    int newline = 1, escapes = 0, i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        const char *f = argv[i] + 1;
+        if (strspn(f, "neE") != strlen(f)) break;     // not an option: print it
+        for (; *f; f++) {
+            if (*f == 'n') newline = 0;
+            else if (*f == 'e') escapes = 1;
+            else escapes = 0;
+        }
+    }
+    for (; i < argc; i++) {
+        if (escapes) {
+            if (put_escaped(argv[i])) return fflush(stdout) == 0 ? 0 : 1;
+        } else {
+            fputs(argv[i], stdout);
+        }
+        if (i + 1 < argc) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+// any other option (-n, -A, --) is the external cat's
+int builtin_cat_takes(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] && strcmp(argv[i], "-u") != 0) return 0;
+    }
+    return 1;
+}
+
+// cat [-u] [file|-]...: the kernel moves the bytes where it can (zcopy.c)
+int builtin_cat(int argc, char **argv) {
+    int rc = 0, i = 1;
+    if (i < argc && strcmp(argv[i], "-u") == 0) i++;     // never buffered anyway
+    fflush(stdout);
+    // appending a file to itself would never reach its end
+    struct stat out_st, in_st;
+    int out_file = fstat(STDOUT_FILENO, &out_st) == 0 && S_ISREG(out_st.st_mode);
+    char *only_stdin[] = {"-", NULL};
+    if (i == argc) {
+        argv = only_stdin;
+        argc = 1;
+        i = 0;
+    }
+    for (; i < argc; i++) {
+        int fd = strcmp(argv[i], "-") == 0 ? STDIN_FILENO : open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+            rc = 1;
+            continue;
+        }
+        if (out_file && fstat(fd, &in_st) == 0 &&
+            in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+            fprintf(stderr, "cat: %s: input file is output file\n", argv[i]);
+            if (fd != STDIN_FILENO) close(fd);
+            rc = 1;
+            continue;
+        }
+        off_t n = zcopy(fd, STDOUT_FILENO);
+        int err = errno;
+        if (fd != STDIN_FILENO) close(fd);
+        if (n < 0) {
+            if (err == EPIPE) return 1;     // the reader is gone
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(err));
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+int builtin_pwd(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    char buf[PATH_MAX];
+    if (!getcwd(buf, sizeof(buf))) {
+        perror("pwd");
+        return 1;
+    }
+    puts(buf);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+int builtin_true(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    return 0;
+}
+
+int builtin_false(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    return 1;
+}
+
+/* ---- printf ---- */
+
+static int printf_status;
+
+// numeric argument: 'c is the character's code, like POSIX printf
+static long long num_arg(const char *s) {
+    if (*s == '\'' || *s == '"') return (unsigned char)s[1];
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 0);
+    if (end == s || *end || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", s);
+        printf_status = 1;
+    }
+    return v;
+}
+
+static double float_arg(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || *end) {
+        fprintf(stderr, "printf: %s: invalid number\n", s);
+        printf_status = 1;
+    }
+    return v;
+}
+
+/* Format once against args from *ai. The format is reused while arguments
+ * remain; missing ones read as "" or 0. Returns -1 when \c stops output. */
+static int format_once(const char *fmt, int argc, char **argv, int *ai) {
+    for (const char *f = fmt; *f; ) {
+        if (*f == '\\') {
+            f++;
+            int c = escape(&f, 0);
+            if (c < 0) return -1;
+            putchar(c);
+            continue;
+        }
+        if (*f != '%') {
+            putchar(*f++);
+            continue;
+        }
+        if (f[1] == '%') {
+            putchar('%');
+            f += 2;
+            continue;
+        }
+
+        // %[flags][width][.prec]conv, with * taken from the arguments
+        char spec[64];
+        size_t n = 0;
+        spec[n++] = *f++;
+        int stars[2], nstar = 0;
+        while (*f && strchr("-+ #0", *f) && n < 40) spec[n++] = *f++;
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*f != '.') break;
+                spec[n++] = *f++;
+            }
+            if (*f == '*') {
+                spec[n++] = *f++;
+                stars[nstar++] = (int)(*ai < argc ? num_arg(argv[(*ai)++]) : 0);
+            } else {
+                while (*f >= '0' && *f <= '9' && n < 50) spec[n++] = *f++;
+            }
+        }
+        char conv = *f;
+        if (!conv) {
+            fprintf(stderr, "printf: missing conversion\n");
+            printf_status = 1;
+            return 0;
+        }
+        f++;
+        const char *arg = *ai < argc ? argv[(*ai)++] : NULL;
+
+        switch (conv) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': {
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conv == 'i' ? 'd' : conv;
+            spec[n] = '\0';
+            long long v = arg ? num_arg(arg) : 0;
+            if (nstar == 2) printf(spec, stars[0], stars[1], v);
+            else if (nstar == 1) printf(spec, stars[0], v);
+            else printf(spec, v);
+            break;
+        }
+        case 'c': {
+            spec[n++] = 'c';
+            spec[n] = '\0';
+            int v = arg ? (unsigned char)arg[0] : 0;
+            if (nstar == 2) printf(spec, stars[0], stars[1], v);
+            else if (nstar == 1) printf(spec, stars[0], v);
+            else printf(spec, v);
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+            spec[n++] = conv;
+            spec[n] = '\0';
+            double v = arg ? float_arg(arg) : 0;
+            if (nstar == 2) printf(spec, stars[0], stars[1], v);
+            else if (nstar == 1) printf(spec, stars[0], v);
+            else printf(spec, v);
+            break;
+        }
+        case 's':
+        case 'b': {
+            spec[n++] = 's';
+            spec[n] = '\0';
+            if (conv == 'b' && arg) {
+                // escapes in the argument; width and precision are ignored
+                if (put_escaped(arg)) return -1;
+                break;
+            }
+            if (!arg) arg = "";
+            if (nstar == 2) printf(spec, stars[0], stars[1], arg);
+            else if (nstar == 1) printf(spec, stars[0], arg);
+            else printf(spec, arg);
+            break;
+        }
+        default:
+            fprintf(stderr, "printf: %%%c: invalid conversion\n", conv);
+            printf_status = 1;
+            return 0;
+        }
+    }
+    return 0;
+}
+
+int builtin_printf(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: printf format [arguments]\n");
+        return 2;
+    }
+    printf_status = 0;
+    int ai = 2;
+    do {
+        int before = ai;
+        if (format_once(argv[1], argc, argv, &ai) < 0) break;
+        if (ai == before) break;    // format takes no arguments
+    } while (ai < argc);
+    if (fflush(stdout) != 0) return 1;
+    return printf_status;
+}
+
+/* ---- test / [ ----
+ *   expr := and ( -o and )*
+ *   and  := not ( -a not )*
+ *   not  := ! not | primary
+ *   primary := ( expr ) | -op arg | arg binop arg | arg
+ * A binary operator in second position wins over reading the first word
+ * as a unary operator, which is what POSIX's by-argument-count rules
+ * amount to for the forms scripts use.
+ */
+
+typedef struct {
+    char **av;
+    int    n, i;
+    int    error;
+} test_state;
+
+static int test_expr(test_state *t);
+
+static const char *test_peek(test_state *t, int k) {
+    return t->i + k < t->n ? t->av[t->i + k] : NULL;
+}
+
+static int is_binop(const char *s) {
+    static const char *const ops[] = {
+        "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL,
+    };
+    for (int i = 0; s && ops[i]; i++) {
+        if (strcmp(s, ops[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static long long test_int(test_state *t, const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t') end++;
+    if (end == s || *end || errno) {
+        fprintf(stderr, "test: %s: integer expression expected\n", s);
+        t->error = 1;
+    }
+    return v;
+}
+
+static int test_binary(test_state *t, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    static const char *const int_ops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+    for (int k = 0; k < 6; k++) {
+        if (strcmp(op, int_ops[k]) != 0) continue;
+        long long x = test_int(t, a), y = test_int(t, b);
+        switch (k) {
+        case 0:  return x == y;
+        case 1:  return x != y;
+        case 2:  return x < y;
+        case 3:  return x <= y;
+        case 4:  return x > y;
+        default: return x >= y;
+        }
+    }
+    // -ef, -nt, -ot: one stat() per operand, shared when both name the same path
+    struct stat sa, sb;
+    int ha = stat(a, &sa) == 0;
+    int hb = strcmp(a, b) == 0 ? (sb = sa, ha) : stat(b, &sb) == 0;
+    if (strcmp(op, "-ef") == 0) return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    long long ma = ha ? (long long)sa.st_mtim.tv_sec * 1000000000LL + sa.st_mtim.tv_nsec : 0;
+    long long mb = hb ? (long long)sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec : 0;
+    if (strcmp(op, "-nt") == 0) return ha && (!hb || ma > mb);
+    return hb && (!ha || ma < mb);                                           // -ot
+}
+
+static int test_unary(test_state *t, char op, const char *arg) {
+    struct stat st;
+    switch (op) {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 't': return isatty((int)test_int(t, arg));
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 'h':
+    case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) != 0) return 0;
+    switch (op) {
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    }
+    return 0;
+}
+
+static int test_primary(test_state *t) {
+    const char *a = test_peek(t, 0);
+    if (!a) {
+        fprintf(stderr, "test: argument expected\n");
+        t->error = 1;
+        return 0;
+    }
+    if (is_binop(test_peek(t, 1)) && test_peek(t, 2)) {
+        const char *op = test_peek(t, 1), *b = test_peek(t, 2);
+        t->i += 3;
+        return test_binary(t, a, op, b);
+    }
+    if (strcmp(a, "(") == 0 && t->n - t->i > 1) {
+        t->i++;
+        int v = test_expr(t);
+        const char *close = test_peek(t, 0);
+        if (!close || strcmp(close, ")") != 0) {
+            fprintf(stderr, "test: ')' expected\n");
+            t->error = 1;
+            return 0;
+        }
+        t->i++;
+        return v;
+    }
+    if (a[0] == '-' && a[1] && !a[2] && strchr("nztrwxhLefdbcpSsug", a[1]) && test_peek(t, 1)) {
+        const char *arg = test_peek(t, 1);
+        t->i += 2;
+        return test_unary(t, a[1], arg);
+    }
+    t->i++;
+    return a[0] != '\0';
+}
+
+static int test_not(test_state *t) {
+    const char *a = test_peek(t, 0);
+    if (a && strcmp(a, "!") == 0 && t->n - t->i > 1) {
+        t->i++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(test_state *t) {
+    int v = test_not(t);
+    while (!t->error && test_peek(t, 0) && strcmp(test_peek(t, 0), "-a") == 0) {
+        t->i++;
+        int r = test_not(t);
+        v = v && r;
+    }
+    return v;
+}
+
+static int test_expr(test_state *t) {
+    int v = test_and(t);
+    while (!t->error && test_peek(t, 0) && strcmp(test_peek(t, 0), "-o") == 0) {
+        t->i++;
+        int r = test_and(t);
+        v = v || r;
+    }
+    return v;
+}
+
+// 0 true, 1 false, 2 usage error
+int builtin_test(int argc, char **argv) {
+    int n = argc;
+    if (strcmp(argv[0], "[") == 0) {
+        if (n < 2 || strcmp(argv[n - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        n--;
+    }
+    test_state t = { argv + 1, n - 1, 0, 0 };
+    if (t.n == 0) return 1;
+    int v = test_expr(&t);
+    if (!t.error && t.i < t.n) {
+        fprintf(stderr, "test: %s: unexpected argument\n", t.av[t.i]);
+        t.error = 1;
+    }
+    if (t.error) return 2;
+    return v ? 0 : 1;
+}
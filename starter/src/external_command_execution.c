@@ -8,27 +8,8 @@
 #include <fcntl.h>
 #include <string.h>
 #include "external_command_execution.h"
-//global job tracking
-static Job jobs[MAX_JOBS];
-static int next_job_no = 1;
-
-//helper function to add a job to the job list
-static void add_job(pid_t pid, const char *cmdline) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (!jobs[i].active) {
-            jobs[i].active = 1;
-            jobs[i].pid = pid;
-            jobs[i].job_no = next_job_no++;
-            strncpy(jobs[i].cmdline, cmdline ? cmdline : "", CMDLINE_MAX - 1);
-            jobs[i].cmdline[CMDLINE_MAX - 1] = '\0';
-            printf("[%d] %d\n", jobs[i].job_no, (int)pid);
-            fflush(stdout);
-            return;
-        }
-    }
-    fprintf(stderr, "warning: job table full\n");
-}
-
+#include "jobs.h"
+#include "launch.h"
 //helper function to build command line string
 static void build_cmdline(char *cmdline, char *const argv[]) {
     cmdline[0] = '\0';
@@ -39,86 +20,84 @@ static void build_cmdline(char *cmdline, char *const argv[]) {
 }
 
 void run_command(const char *command_path, char *const argv[], int isBackgroundProcess){
-    pid_t pid = fork();
+    launch_spec ls;
+    launch_spec_init(&ls);
+    if (isBackgroundProcess) ls.pgid = 0;  //own process group, like shell.c jobs
+    pid_t pid = launch_process(command_path, argv, &ls);
+    launch_spec_free(&ls);
     if (pid == -1) {
-        perror("fork failed");
         return;
     }
-    if (pid == 0) {
-        execv(command_path, argv);
-        perror("execv failed");
-        exit(EXIT_FAILURE);
+    if (isBackgroundProcess){
+        char cmdline[CMDLINE_MAX];
+        build_cmdline(cmdline, argv);
+        job_add(pid, &pid, 1, cmdline, 0);
     }
     else{
-        if (isBackgroundProcess){
-            char cmdline[CMDLINE_MAX];
-            build_cmdline(cmdline, argv);
-            add_job(pid, cmdline);
-        }
-        else{
-            int status;
-            if (waitpid(pid, &status, 0) == -1) {
-                perror("waitpid failed");
-            } else if (WIFEXITED(status)) {
-                //child exited normally
-            }
+        int status;
+        if (waitpid(pid, &status, 0) == -1) {
+            perror("waitpid failed");
+        } else if (WIFEXITED(status)) {
+            //child exited normally
         }
     }
 }
 
 void run_command_with_redirection(char* command_path, char *const argv[], char *file_in, char *file_out, int isBackgroundProcess) {
-    pid_t pid = fork();
-    //make sure fork is successful
+    //open redirect targets in the parent so either launch engine can dup2 them
+    int fd_in = -1, fd_out = -1;
+    if (file_in) {
+        fd_in = open(file_in, O_RDONLY);
+        if (fd_in < 0) {
+            perror("open input failed");
+            return;
+        }
+    }
+    if (file_out) {
+        fd_out = open(file_out, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd_out < 0) {
+            perror("open output failed");
+            if (fd_in >= 0) close(fd_in);
+            return;
+        }
+    }
+
+    launch_spec ls;
+    launch_spec_init(&ls);
+    if (isBackgroundProcess) ls.pgid = 0;
+    if (fd_in >= 0) {
+        launch_dup2(&ls, fd_in, STDIN_FILENO);
+        launch_close(&ls, fd_in);
+    }
+    if (fd_out >= 0) {
+        launch_dup2(&ls, fd_out, STDOUT_FILENO);
+        launch_close(&ls, fd_out);
+    }
+    pid_t pid = launch_process(command_path, argv, &ls);
+    launch_spec_free(&ls);
+    if (fd_in >= 0) close(fd_in);
+    if (fd_out >= 0) close(fd_out);
     if (pid == -1) {
-        perror("fork failed");
         return;
     }
-    //check if child or parent
-    if (pid == 0) {//child
+
+    if (isBackgroundProcess){
+        char cmdline[CMDLINE_MAX];
+        build_cmdline(cmdline, argv);
+        //add redirection info to command line
         if (file_in) {
-            int fd_in = open(file_in, O_RDONLY);
-            if (fd_in < 0) {
-                perror("open input failed");
-                exit(1);
-            }
-            dup2(fd_in, STDIN_FILENO);
-            close(fd_in);
+            strcat(cmdline, " < ");
+            strcat(cmdline, file_in);
         }
-
         if (file_out) {
-            int fd_out = open(file_out,
-                              O_WRONLY | O_CREAT | O_TRUNC,
-                              S_IRUSR | S_IWUSR);
-            if (fd_out < 0) {
-                perror("open output failed");
-                exit(1);
-            }
-            dup2(fd_out, STDOUT_FILENO);
-            close(fd_out);
-        }
-
-        execvp(command_path, argv);
-        perror("exec failed");
-        exit(1);
-    } else {//parent
-        if (isBackgroundProcess){
-            char cmdline[CMDLINE_MAX];
-            build_cmdline(cmdline, argv);
-            //add redirection info to command line
-            if (file_in) {
-                strcat(cmdline, " < ");
-                strcat(cmdline, file_in);
-            }
-            if (file_out) {
-                strcat(cmdline, " > ");
-                strcat(cmdline, file_out);
-            }
-            add_job(pid, cmdline);
-        }
-        else{
-            int status;
-            waitpid(pid, &status, 0);
+            strcat(cmdline, " > ");
+            strcat(cmdline, file_out);
         }
+        job_add(pid, &pid, 1, cmdline, 0);
+    }
+    else{
+        int status;
+        waitpid(pid, &status, 0);
     }
 }
 
@@ -127,29 +106,14 @@ void check_finished_jobs(void) {
     int status;
     pid_t pid;
     while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        for (int i = 0; i < MAX_JOBS; i++) {
-            if (jobs[i].active && jobs[i].pid == pid) {
-                jobs[i].active = 0;
-                printf("[%d] + done %s\n", jobs[i].job_no, jobs[i].cmdline);
-                fflush(stdout);
-                break;
-            }
-        }
+        job_child_status(pid, status, NULL);
     }
+    jobs_print_notices();
 }
 
 //print list of active background jobs
 void print_jobs(void) {
-    int any = 0;
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].active) {
-            any = 1;
-            printf("[%d]+ %d %s\n", jobs[i].job_no, (int)jobs[i].pid, jobs[i].cmdline);
-        }
-    }
-    if (!any) {
-        printf("no active background processes\n");
-    }
+    jobs_print();
 }
 
 // Check if command is a built-in command
@@ -198,12 +162,7 @@ int execute_builtin_command(char **argv, int argc, char history[][CMDLINE_MAX],
 
     if (strcmp(command, "exit") == 0) {
         //wait for all background processes to finish
-        for (int i = 0; i < MAX_JOBS; i++) {
-            if (jobs[i].active) {
-                waitpid(jobs[i].pid, NULL, 0);
-                jobs[i].active = 0;
-            }
-        }
+        jobs_wait_all();
 
         //display command history upon exit
         if (hist_count == 0) {
@@ -0,0 +1,689 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "history.h"
+
+/* Command history.
+ * Entries are numbered from 1 and live in ents[]; entry n is
+ * ents[n - base]. Lines typed this session are copied into one string
+ * arena, and so are the lines kept from the history file: startup costs
+ * a scan of the file's tail and one copy of it.
+ * The file is only read on first use, and only its last HISTSIZE lines
+ * are indexed. New lines are appended to it as they are recorded, with an
+ * fdatasync() every HIST_SYNC_BATCH lines and at exit.
+ * Prefix search (!str) follows hash chains like a compressor's match
+ * finder: each entry links to the previous one with the same first byte
+ * and the previous one with the same first two bytes, so a lookup only
+ * visits candidates that already agree on the start.
+ * Ctrl-R's substring search uses an n-gram index: for every byte, every
+ * byte pair, and every trigram hash, the ascending list of entries
+ * containing it. A query walks only the shortest list among its own
+ * grams (trigrams once it has three bytes), newest first, and confirms
+ * each candidate with a plain compare, so even a query with no match
+ * costs one short list. The index is built on the first reverse search,
+ * which goes on to search once per key, and then extended as each line
+ * is recorded. It is several times the size of the history (170 MB at
+ * 1M entries), so one-off lookups (history -s, !prefix) scan instead,
+ * and use it only if it is already there.
+ */
+#define CHAIN2_BITS 12
+#define TRI_BITS    16
+#define NGRAM_LISTS (256 + 65536 + (1 << TRI_BITS))
+
+typedef struct {
+    size_t   off;           // in the arena
+    uint32_t len;
+    uint32_t prev1, prev2;  // older entry with the same first byte / two bytes, 0 = none
+} hist_ent;
+
+static hist_ent *ents;
+static size_t    lo, nents, ents_cap;   // live entries are ents[lo .. nents)
+static unsigned  base = 1;              // number of ents[0]
+static unsigned  histsize = HISTSIZE_DEFAULT;
+static unsigned  session_first;         // first number added this session, 0 = none
+
+static char  *arena;
+static size_t arena_used, arena_cap;
+
+static char *path;
+static int   hist_fd = -1;
+static int   unsynced;
+static int   loaded;
+static int   tail_checked;  // the file ends in a newline, or one was written
+
+static uint32_t head1[256];
+static uint32_t head2[1 << CHAIN2_BITS];
+static int      indexed;
+
+typedef struct {
+    uint32_t *n;            // entry numbers, ascending
+    uint32_t  len, cap;
+} posting;
+
+static posting *grams;      // NGRAM_LISTS lists once built
+static int      grams_ready;
+
+static unsigned key2(const char *s) {
+    return (((unsigned char)s[0] << 8 | (unsigned char)s[1]) * 40503u) >> (16 - CHAIN2_BITS) &
+           ((1u << CHAIN2_BITS) - 1);
+}
+
+static const char *ent_text(const hist_ent *e) {
+    return arena + e->off;
+}
+
+static hist_ent *ent(unsigned n) {
+    if (n < base + lo || n >= base + nents) return NULL;
+    return &ents[n - base];
+}
+
+static void link_entry(unsigned n) {
+    hist_ent *e = &ents[n - base];
+    const char *s = ent_text(e);
+    e->prev1 = e->prev2 = 0;
+    if (e->len == 0) return;
+    unsigned char c = (unsigned char)s[0];
+    e->prev1 = head1[c];
+    head1[c] = n;
+    if (e->len >= 2) {
+        unsigned k = key2(s);
+        e->prev2 = head2[k];
+        head2[k] = n;
+    }
+}
+
+static void build_index(void) {
+    indexed = 1;
+    for (unsigned n = base + (unsigned)lo; n < base + nents; n++) link_entry(n);
+}
+
+//drop entries past HISTSIZE; the arrays are shifted only once half is dead
+static void trim(void) {
+    while (nents - lo > histsize) lo++;
+    if (lo == 0 || lo * 2 < nents) return;
+
+    size_t arena_from = lo < nents ? ents[lo].off : arena_used;
+    memmove(arena, arena + arena_from, arena_used - arena_from);
+    arena_used -= arena_from;
+    for (size_t i = lo; i < nents; i++) ents[i].off -= arena_from;
+    memmove(ents, ents + lo, (nents - lo) * sizeof(*ents));
+    base += (unsigned)lo;
+    nents -= lo;
+    lo = 0;
+    grams_ready = 0;    // rebuilt on the next search, dropping dead postings
+}
+
+static hist_ent *push_entry(void) {
+    if (nents == ents_cap) {
+        size_t cap = ents_cap ? ents_cap * 2 : 256;
+        hist_ent *tmp = realloc(ents, cap * sizeof(*tmp));
+        if (!tmp) return NULL;
+        ents = tmp;
+        ents_cap = cap;
+    }
+    hist_ent *e = &ents[nents++];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+static int arena_reserve(size_t extra) {
+    if (arena_used + extra <= arena_cap) return 0;
+    size_t cap = arena_cap ? arena_cap * 2 : 4096;
+    while (cap < arena_used + extra) cap *= 2;
+    char *tmp = realloc(arena, cap);
+    if (!tmp) return -1;
+    arena = tmp;
+    arena_cap = cap;
+    return 0;
+}
+
+/* Replace the file with just its kept lines: written next to it and
+ * renamed over it, so a crash leaves the old file or the new one. Lines
+ * another shell appends to the old file meanwhile are lost, as in bash. */
+static void rewrite_file(const char *text, size_t len) {
+    char *tmp = malloc(strlen(path) + 8);
+    if (!tmp) return;
+    sprintf(tmp, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return;
+    }
+    int ok = 1;
+    for (size_t done = 0; ok && done < len; ) {
+        ssize_t w = write(fd, text + done, len - done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) ok = 0;
+        else done += (size_t)w;
+    }
+    if (ok && len > 0 && text[len - 1] != '\n') ok = write(fd, "\n", 1) == 1;
+    if (ok) ok = fdatasync(fd) == 0;
+    close(fd);
+    if (ok && rename(tmp, path) == 0) {
+        if (hist_fd >= 0) close(hist_fd);
+        hist_fd = open(path, O_RDWR | O_APPEND | O_CLOEXEC);
+        tail_checked = 1;
+    } else {
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+/* Read the last histsize lines of the history file. The file is mapped to
+ * find where they start, and they are copied into the arena before it is
+ * unmapped: another process can truncate the file (> ~/.shell_history),
+ * and touching a mapped page past its new end raises SIGBUS. Once the
+ * lines dropped make up a quarter of the file it is cut back to the kept
+ * ones, so it stays within a third over HISTSIZE without being rewritten
+ * every session. */
+static void load(void) {
+    loaded = 1;
+    if (!path || histsize == 0) return;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        perror("history: mmap");
+        return;
+    }
+    const char *map = m;
+    size_t map_len = (size_t)st.st_size;
+
+    // walk back over the tail to where the kept lines start
+    size_t from = map_len;
+    if (map[from - 1] == '\n') from--;
+    for (unsigned lines = 0; from > 0 && lines < histsize; ) {
+        size_t i = from;
+        while (i > 0 && map[i - 1] != '\n') i--;
+        if (i < from) lines++;          // blank lines are not entries
+        from = i;
+        if (lines < histsize && from > 0) from--;
+    }
+
+    size_t keep = map_len - from;
+    if (arena_reserve(keep + 1) == 0) {
+        // one copy of the tail; its newlines become the entries' NULs
+        memcpy(arena, map + from, keep);
+        arena[keep] = '\0';
+        arena_used = keep + 1;
+        for (size_t off = 0; off < keep; ) {
+            char *nl = memchr(arena + off, '\n', keep - off);
+            size_t end = nl ? (size_t)(nl - arena) : keep;
+            arena[end] = '\0';
+            if (end > off) {
+                hist_ent *e = push_entry();
+                if (!e) break;
+                e->off = off;
+                e->len = (uint32_t)(end - off);
+            }
+            off = end + 1;
+        }
+        if (from >= map_len / 4 && from > 0) rewrite_file(map + from, keep);
+    }
+    munmap(m, map_len);
+    trim();
+}
+
+static void ensure_loaded(void) {
+    if (!loaded) load();
+}
+
+void history_init(int persist) {
+    const char *hs = getenv("HISTSIZE");
+    if (hs && *hs) {
+        char *end;
+        long v = strtol(hs, &end, 10);
+        if (*end == '\0' && v >= 0) histsize = (unsigned)v;
+    }
+    if (!persist) {
+        loaded = 1;
+        return;
+    }
+    const char *hf = getenv("HISTFILE");
+    if (hf) {
+        if (*hf) path = strdup(hf);
+    } else {
+        const char *home = getenv("HOME");
+        if (home) {
+            path = malloc(strlen(home) + sizeof(HISTFILE_DEFAULT) + 1);
+            if (path) sprintf(path, "%s/%s", home, HISTFILE_DEFAULT);
+        }
+    }
+    if (!path) {
+        loaded = 1;
+        return;
+    }
+    hist_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (hist_fd < 0) fprintf(stderr, "history: %s: %s\n", path, strerror(errno));
+    atexit(history_sync);
+}
+
+void history_sync(void) {
+    if (hist_fd >= 0 && unsynced) fdatasync(hist_fd);
+    unsynced = 0;
+}
+
+// list for the k-byte gram at s: bytes and pairs exactly, trigrams hashed
+static posting *gram_list(const char *s, int k) {
+    const unsigned char *u = (const unsigned char *)s;
+    if (k == 1) return &grams[u[0]];
+    if (k == 2) return &grams[256 + (u[0] << 8 | u[1])];
+    uint32_t v = (uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2];
+    return &grams[256 + 65536 + ((v * 2654435761u) >> (32 - TRI_BITS))];
+}
+
+static void grams_add(unsigned n) {
+    hist_ent *e = &ents[n - base];
+    const char *s = ent_text(e);
+    for (uint32_t i = 0; i < e->len; i++) {
+        for (int k = 1; k <= 3 && i + k <= e->len; k++) {
+            posting *p = gram_list(s + i, k);
+            if (p->len && p->n[p->len - 1] == n) continue;     // repeated gram
+            if (p->len == p->cap) {
+                uint32_t cap = p->cap ? p->cap * 2 : 4;
+                uint32_t *tmp = realloc(p->n, cap * sizeof(*tmp));
+                if (!tmp) return;   // lost postings only hide this entry
+                p->n = tmp;
+                p->cap = cap;
+            }
+            p->n[p->len++] = n;
+        }
+    }
+}
+
+static int grams_build(void) {
+    if (!grams && !(grams = calloc(NGRAM_LISTS, sizeof(*grams)))) return -1;
+    for (size_t i = 0; i < NGRAM_LISTS; i++) grams[i].len = 0;
+    for (unsigned n = base + (unsigned)lo; n < base + nents; n++) grams_add(n);
+    for (size_t i = 0; i < NGRAM_LISTS; i++) {
+        // trim the doubling slack; lists grow again as lines are added
+        posting *p = &grams[i];
+        uint32_t *tmp = p->len < p->cap && p->len ? realloc(p->n, p->len * sizeof(*tmp)) : NULL;
+        if (tmp) {
+            p->n = tmp;
+            p->cap = p->len;
+        }
+    }
+    grams_ready = 1;
+    return 0;
+}
+
+void history_add(const char *line, size_t len) {
+    ensure_loaded();
+    if (histsize == 0 || len == 0 || arena_reserve(len + 1) != 0) return;
+    hist_ent *e = push_entry();
+    if (!e) return;
+    memcpy(arena + arena_used, line, len);
+    arena[arena_used + len] = '\0';
+    e->off = arena_used;
+    e->len = (uint32_t)len;
+    arena_used += len + 1;
+
+    unsigned n = base + (unsigned)nents - 1;
+    if (!session_first) session_first = n;
+    if (indexed) link_entry(n);
+    if (grams_ready) grams_add(n);
+    trim();
+
+    if (hist_fd >= 0) {
+        // a last line written without its newline is ended first, or this
+        // one would be glued onto it
+        struct stat st;
+        char last = '\n';
+        if (!tail_checked && fstat(hist_fd, &st) == 0 && st.st_size > 0 &&
+            pread(hist_fd, &last, 1, st.st_size - 1) != 1) {
+            last = '\n';
+        }
+        tail_checked = 1;
+        // one append per line keeps concurrent shells' lines whole
+        struct iovec iov[3] = {
+            { "\n", last != '\n' },
+            { (void *)line, len },
+            { "\n", 1 },
+        };
+        if (writev(hist_fd, iov, 3) < 0) {
+            perror("history");
+        } else if (++unsynced >= HIST_SYNC_BATCH) {
+            history_sync();
+        }
+    }
+}
+
+// numbering goes on, so a !n from before the clear finds nothing rather
+// than a newer command
+void history_clear(void) {
+    ensure_loaded();
+    base += (unsigned)nents;
+    lo = nents = 0;
+    arena_used = 0;
+    session_first = 0;
+    memset(head1, 0, sizeof(head1));
+    memset(head2, 0, sizeof(head2));
+    grams_ready = 0;
+}
+
+unsigned history_first(void) {
+    ensure_loaded();
+    return base + (unsigned)lo;
+}
+
+unsigned history_last(void) {
+    ensure_loaded();
+    return base + (unsigned)nents - 1;
+}
+
+unsigned history_session_count(void) {
+    if (!session_first) return 0;
+    unsigned first = history_first();
+    return history_last() + 1 - (session_first > first ? session_first : first);
+}
+
+// Entry n (NUL-terminated), or NULL if out of range
+const char *history_get(unsigned n, size_t *len) {
+    ensure_loaded();
+    hist_ent *e = ent(n);
+    if (!e) return NULL;
+    *len = e->len;
+    return ent_text(e);
+}
+
+static int contains(const char *s, size_t len, const char *q, size_t qlen) {
+    for (const char *p = s, *end = s + len; (size_t)(end - p) >= qlen; p++) {
+        p = memchr(p, q[0], (size_t)(end - p) - qlen + 1);
+        if (!p) return 0;
+        if (memcmp(p, q, qlen) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Number of the newest entry before `before` containing q (or, with
+ * prefix set, starting with it), or 0. Without the index (or with build
+ * set and no memory for it) entries are compared newest first.
+ */
+static unsigned gram_search(const char *q, size_t qlen, unsigned before, int prefix, int build) {
+    ensure_loaded();
+    unsigned first = base + (unsigned)lo;
+    unsigned end = base + (unsigned)nents;
+    if (before > end) before = end;
+    if (before <= first) return 0;
+    if (qlen == 0) return before - 1;
+
+    if (!grams_ready && (!build || grams_build() != 0)) {
+        for (unsigned n = before - 1; n >= first; n--) {
+            hist_ent *e = &ents[n - base];
+            if (prefix ? e->len >= qlen && memcmp(ent_text(e), q, qlen) == 0
+                       : contains(ent_text(e), e->len, q, qlen)) return n;
+        }
+        return 0;
+    }
+
+    int k = qlen < 3 ? (int)qlen : 3;
+    const posting *best = NULL;
+    for (size_t i = 0; i + (size_t)k <= qlen; i++) {
+        const posting *p = gram_list(q + i, k);
+        if (!best || p->len < best->len) best = p;
+    }
+    // newest posting below `before`, then walk down
+    uint32_t lo_i = 0, hi_i = best->len;
+    while (lo_i < hi_i) {
+        uint32_t mid = lo_i + (hi_i - lo_i) / 2;
+        if (best->n[mid] < before) lo_i = mid + 1;
+        else hi_i = mid;
+    }
+    for (uint32_t i = lo_i; i-- > 0 && best->n[i] >= first; ) {
+        hist_ent *e = &ents[best->n[i] - base];
+        if (prefix ? e->len >= qlen && memcmp(ent_text(e), q, qlen) == 0
+                   : contains(ent_text(e), e->len, q, qlen)) return best->n[i];
+    }
+    return 0;
+}
+
+unsigned history_search(const char *q, size_t qlen, unsigned before) {
+    return gram_search(q, qlen, before, 0, 0);
+}
+
+/* Number of the newest entry starting with prefix, or 0. Longer
+ * prefixes go through the n-gram index when Ctrl-R has built it; the
+ * chains only tell the first two bytes apart.
+ */
+unsigned history_search_prefix(const char *prefix, size_t len) {
+    ensure_loaded();
+    if (len > 2 && grams_ready) return gram_search(prefix, len, history_last() + 1, 1, 0);
+    if (!indexed) build_index();
+    unsigned first = base + (unsigned)lo;
+    if (len == 0) return nents > lo ? history_last() : 0;
+
+    int two = len >= 2;
+    unsigned n = two ? head2[key2(prefix)] : head1[(unsigned char)prefix[0]];
+    while (n >= first) {
+        hist_ent *e = &ents[n - base];
+        if (e->len >= len && memcmp(ent_text(e), prefix, len) == 0) return n;
+        n = two ? e->prev2 : e->prev1;
+    }
+    return 0;
+}
+
+/* Incremental reverse search, one key at a time (readline's Ctrl-R).
+ * Typing extends the query and re-searches from the current match,
+ * Ctrl-R steps to the next older match, backspace undoes the last step.
+ */
+void isearch_begin(isearch *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+static void isearch_push(isearch *s) {
+    if (s->depth == ISEARCH_MAX) {
+        memmove(s->trail, s->trail + 1, (ISEARCH_MAX - 1) * sizeof(s->trail[0]));
+        s->depth--;
+    }
+    s->trail[s->depth].len = (unsigned)s->len;
+    s->trail[s->depth].match = s->match;
+    s->trail[s->depth].failing = s->failing;
+    s->depth++;
+}
+
+int isearch_key(isearch *s, int c) {
+    unsigned n;
+    switch (c) {
+    case '\r':
+    case '\n':
+        return ISEARCH_ACCEPT;
+    case 0x07:              // Ctrl-G
+    case 0x03:              // Ctrl-C
+        return ISEARCH_ABORT;
+    case 0x7f:
+    case 0x08:
+        if (s->depth > 0) {
+            s->depth--;
+            s->len = s->trail[s->depth].len;
+            s->match = s->trail[s->depth].match;
+            s->failing = s->trail[s->depth].failing;
+        }
+        return ISEARCH_MORE;
+    case 0x12:              // Ctrl-R
+        isearch_push(s);
+        n = gram_search(s->query, s->len, s->match ? s->match : history_last() + 1, 0, 1);
+        if (n) s->match = n;
+        s->failing = !n;
+        return ISEARCH_MORE;
+    default:
+        if (c < 0x20 || c > 0xff) return ISEARCH_PASS;
+        if (s->len + 1 >= sizeof(s->query)) return ISEARCH_MORE;
+        isearch_push(s);
+        s->query[s->len++] = (char)c;
+        s->query[s->len] = '\0';
+        n = gram_search(s->query, s->len, s->match ? s->match + 1 : history_last() + 1, 0, 1);
+        if (n) s->match = n;
+        s->failing = !n;
+        return ISEARCH_MORE;
+    }
+}
+
+static int buf_add(char **buf, size_t *used, size_t *cap, const char *s, size_t len) {
+    if (*used + len + 1 > *cap) {
+        size_t c = *cap ? *cap * 2 : 256;
+        while (c < *used + len + 1) c *= 2;
+        char *tmp = realloc(*buf, c);
+        if (!tmp) return -1;
+        *buf = tmp;
+        *cap = c;
+    }
+    memcpy(*buf + *used, s, len);
+    *used += len;
+    (*buf)[*used] = '\0';
+    return 0;
+}
+
+/* History expansion of "!!", "!n", "!-n" and "!prefix" at the start of a
+ * word. Returns 0 if the line has none, 1 with the expanded line in a
+ * malloc'd *out, or -1 after reporting an event that does not exist.
+ */
+int history_expand(const char *line, size_t len, char **out, size_t *out_len) {
+    char *buf = NULL;
+    size_t used = 0, cap = 0;
+    size_t copied = 0;      // line[0 .. copied) is already in buf
+    int any = 0;
+
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (line[i] != '!' || (i > 0 && line[i - 1] != ' ' && line[i - 1] != '\t')) continue;
+        size_t j = i + 1;
+        if (line[j] == ' ' || line[j] == '\t' || line[j] == '=') continue;
+
+        unsigned n = 0;
+        if (line[j] == '!') {
+            n = history_last();
+            j++;
+        } else if (line[j] == '-' || (line[j] >= '0' && line[j] <= '9')) {
+            int neg = line[j] == '-';
+            size_t k = j + neg;
+            unsigned long v = 0;
+            while (k < len && line[k] >= '0' && line[k] <= '9') v = v * 10 + (unsigned)(line[k++] - '0');
+            if (k == j + neg) continue;     // "!-" alone
+            n = neg ? (v <= history_last() ? history_last() + 1 - (unsigned)v : 0) : (unsigned)v;
+            j = k;
+        } else {
+            while (j < len && line[j] != ' ' && line[j] != '\t') j++;
+            n = history_search_prefix(line + i + 1, j - i - 1);
+        }
+
+        size_t elen;
+        const char *event = n ? history_get(n, &elen) : NULL;
+        if (!event) {
+            fprintf(stderr, "%.*s: event not found\n", (int)(j - i), line + i);
+            free(buf);
+            return -1;
+        }
+        if (buf_add(&buf, &used, &cap, line + copied, i - copied) != 0 ||
+            buf_add(&buf, &used, &cap, event, elen) != 0) {
+            free(buf);
+            return -1;
+        }
+        copied = j;
+        i = j - 1;
+        any = 1;
+    }
+    if (!any) return 0;
+    if (buf_add(&buf, &used, &cap, line + copied, len - copied) != 0) {
+        free(buf);
+        return -1;
+    }
+    *out = buf;
+    *out_len = used;
+    return 1;
+}
+
+#ifdef HISTORY_BENCH
+/* Load and lookup benchmark over a large history file.
+ * Build with: gcc -O2 -DHISTORY_BENCH -Iinclude -o bin/history_bench src/history.c
+ * Usage: bin/history_bench [entries]
+ */
+#include <time.h>
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv) {
+    unsigned n = argc > 1 ? (unsigned)atoi(argv[1]) : 1000000;
+    static const char *cmds[] = {"git status", "make -j8", "ls -la", "grep -rn foo src", "cd ..",
+                                 "vim src/shell.c", "ssh build01", "cat README.md"};
+    char file[] = "/tmp/history_benchXXXXXX";
+    int fd = mkstemp(file);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    FILE *f = fdopen(fd, "w");
+    for (unsigned i = 0; i < n; i++) fprintf(f, "%s %u\n", cmds[i % 8], i);
+    fprintf(f, "zz unique\n");
+    fclose(f);
+
+    char hs[16];
+    snprintf(hs, sizeof(hs), "%u", n + 1);
+    setenv("HISTSIZE", hs, 1);
+    setenv("HISTFILE", file, 1);
+    history_init(1);
+
+    double t0 = now_us();
+    unsigned last = history_last();
+    double t_load = now_us() - t0;
+
+    t0 = now_us();
+    unsigned hit = history_search_prefix("zz", 2);
+    double t_index = now_us() - t0;
+
+    const int lookups = 100000;
+    static const char *probes[] = {"git s", "ma", "zz", "vim", "c", "ssh build01 1"};
+    t0 = now_us();
+    unsigned found = 0;
+    for (int i = 0; i < lookups; i++) found += history_search_prefix(probes[i % 6], strlen(probes[i % 6])) != 0;
+    double t_look = now_us() - t0;
+
+    printf("%u entries: lazy load %.0f us, prefix chains %.0f us, %.2f us/!prefix lookup (%u/%d found)\n",
+           last, t_load, t_index, t_look / lookups, found, lookups);
+
+    t0 = now_us();
+    grams_build();          // the first Ctrl-R key
+    double t_gram = now_us() - t0;
+    size_t postings = 0;
+    for (size_t i = 0; i < NGRAM_LISTS; i++) postings += grams[i].cap;
+
+    // Ctrl-R: type a query one key at a time, then step through older matches
+    static const char *typed[] = {"grep -rn foo src 4242", "ssh build01 99999", "nothing like this"};
+    double worst = 0, total = 0;
+    int keys = 0;
+    for (int q = 0; q < 3; q++) {
+        isearch is;
+        isearch_begin(&is);
+        size_t nkeys = strlen(typed[q]) + 20;
+        for (size_t k = 0; k < nkeys; k++, keys++) {
+            int c = k < strlen(typed[q]) ? (unsigned char)typed[q][k] : 0x12;
+            double k0 = now_us();
+            isearch_key(&is, c);
+            double dk = now_us() - k0;
+            total += dk;
+            if (dk > worst) worst = dk;
+        }
+    }
+    printf("reverse search: n-gram index built in %.0f us (%.0f MB), %.2f us/key, worst key %.1f us\n",
+           t_gram, postings * 4.0 / (1 << 20), total / keys, worst);
+    unlink(file);
+    return hit == last ? 0 : 1;
+}
+#endif
@@ -0,0 +1,587 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         // wait4()
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include "jobs.h"
+
+/* Job table.
+ * Job number n lives in tab[n - 1], so %n is a direct index; a new job
+ * gets one past the highest number still in use, as in bash. A pid-keyed
+ * open-addressing index finds a job from a waitpid() result in O(1), and
+ * command lines are packed into one string arena instead of a fixed
+ * buffer per slot. Nothing is capped except by memory.
+ * Every stage of a pipeline is indexed, and a job only finishes once all
+ * of them have been reaped; the stages share one process group, so a
+ * signal to -pgid reaches the whole pipeline.
+ * Foreground pipelines are entered too, so a Ctrl-Z can turn one into a
+ * stopped job without losing track of its stages. A job is stopped once
+ * every live stage is, and running again as soon as any one continues.
+ * Job pointers are valid until the next job_add().
+ */
+static Job   *tab;
+static int    tab_len;      // one past the highest slot in use
+static int    tab_cap;
+static int    pending;      // jobs with notify set
+static int    live_procs;   // indexed pids not yet reaped
+
+static char  *arena;        // NUL-terminated command lines
+static size_t arena_used, arena_cap, arena_live;
+
+typedef struct {
+    pid_t pid;              // 0 = empty, -1 = deleted
+    int   slot;
+    int   stage;            // position in the pipeline
+    int   stopped;          // last reported as stopped
+} pid_ent;
+
+static pid_ent *pidx;
+static size_t   pidx_cap, pidx_used;   // used counts deleted entries too
+
+static int announce;
+
+// Job control: only when the shell owns a terminal
+static int   job_control;
+static int   tty = -1;
+static pid_t shell_pgid;
+static struct termios shell_tmodes;
+
+void jobs_set_notify(int on) { announce = on; }
+
+int jobs_control(void) { return job_control; }
+
+/* Put the shell in its own process group in the terminal's foreground.
+ * Started from another shell as a background job, it waits (SIGTTIN)
+ * until brought forward. The signals the terminal sends to the
+ * foreground group are then ignored; they are returned in *ignored so
+ * children can be given the defaults back. Returns -1 if job control is
+ * not available, with the signals ignored all the same.
+ */
+int jobs_init_control(int tty_fd, sigset_t *ignored) {
+    static const int sigs[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU};
+    pid_t pgrp, fg;
+    while ((fg = tcgetpgrp(tty_fd)) >= 0 && fg != (pgrp = getpgrp())) {
+        kill(-pgrp, SIGTTIN);
+    }
+
+    struct sigaction sa = {0};
+    sa.sa_handler = SIG_IGN;
+    sigemptyset(&sa.sa_mask);
+    sigemptyset(ignored);
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+        sigaction(sigs[i], &sa, NULL);
+        sigaddset(ignored, sigs[i]);
+    }
+    if (fg < 0) return -1;
+
+    shell_pgid = getpid();
+    if (getpgrp() != shell_pgid && setpgid(0, shell_pgid) != 0) {
+        perror("setpgid");
+        return -1;
+    }
+    if (tcsetpgrp(tty_fd, shell_pgid) != 0) {
+        perror("tcsetpgrp");
+        return -1;
+    }
+    tcgetattr(tty_fd, &shell_tmodes);
+    tty = tty_fd;
+    job_control = 1;
+    return 0;
+}
+
+// A forked subshell runs its pipelines in the job's group, like a script
+void jobs_drop_control(void) { job_control = 0; }
+
+static int in_use(const Job *j) { return j->state != JOB_DONE || j->notify; }
+
+static size_t pid_hash(pid_t pid) {
+    return ((size_t)pid * 2654435761u) & (pidx_cap - 1);
+}
+
+static pid_ent *pidx_insert(pid_t pid, int slot, int stage);
+
+static int pidx_grow(void) {
+    pid_ent *old = pidx;
+    size_t old_cap = pidx_cap;
+    size_t cap = pidx_cap ? pidx_cap * 2 : 64;
+    // only grow when live entries need it; otherwise rebuild to purge tombstones
+    size_t live = 0;
+    for (size_t i = 0; i < old_cap; i++) live += old[i].pid > 0;
+    if (old_cap && live * 2 < old_cap) cap = old_cap;
+
+    pidx = calloc(cap, sizeof(*pidx));
+    if (!pidx) {
+        pidx = old;
+        return -1;
+    }
+    pidx_cap = cap;
+    pidx_used = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        pid_ent *e = old[i].pid > 0 ? pidx_insert(old[i].pid, old[i].slot, old[i].stage) : NULL;
+        if (e) e->stopped = old[i].stopped;
+    }
+    free(old);
+    return 0;
+}
+
+static pid_ent *pidx_insert(pid_t pid, int slot, int stage) {
+    if ((pidx_used + 1) * 10 > pidx_cap * 7 && pidx_grow() != 0) return NULL;
+    size_t i = pid_hash(pid);
+    while (pidx[i].pid > 0) i = (i + 1) & (pidx_cap - 1);
+    if (pidx[i].pid == 0) pidx_used++;
+    pidx[i].pid = pid;
+    pidx[i].slot = slot;
+    pidx[i].stage = stage;
+    pidx[i].stopped = 0;
+    return &pidx[i];
+}
+
+static pid_ent *pidx_find(pid_t pid) {
+    if (!pidx_cap) return NULL;
+    size_t i = pid_hash(pid);
+    while (pidx[i].pid != 0) {
+        if (pidx[i].pid == pid) return &pidx[i];
+        i = (i + 1) & (pidx_cap - 1);
+    }
+    return NULL;
+}
+
+//drop the space of finished command lines once it outweighs the live ones
+static void arena_compact(void) {
+    if (arena_used - arena_live < 4096 || arena_used - arena_live < arena_live) return;
+    char *fresh = malloc(arena_live ? arena_live : 1);
+    if (!fresh) return;
+    size_t used = 0;
+    for (int i = 0; i < tab_len; i++) {
+        if (!in_use(&tab[i])) continue;
+        size_t len = strlen(arena + tab[i].cmd_off) + 1;
+        memcpy(fresh + used, arena + tab[i].cmd_off, len);
+        tab[i].cmd_off = used;
+        used += len;
+    }
+    free(arena);
+    arena = fresh;
+    arena_used = arena_cap = used;
+}
+
+static int arena_add(const char *s, size_t *off) {
+    size_t len = strlen(s) + 1;
+    if (arena_used + len > arena_cap) {
+        size_t cap = arena_cap ? arena_cap * 2 : 1024;
+        while (cap < arena_used + len) cap *= 2;
+        char *tmp = realloc(arena, cap);
+        if (!tmp) return -1;
+        arena = tmp;
+        arena_cap = cap;
+    }
+    memcpy(arena + arena_used, s, len);
+    *off = arena_used;
+    arena_used += len;
+    arena_live += len;
+    return 0;
+}
+
+//a slot finished and was announced: give back its number and string
+static void release(Job *j) {
+    j->usage = NULL;
+    arena_live -= strlen(arena + j->cmd_off) + 1;
+    while (tab_len > 0 && !in_use(&tab[tab_len - 1])) tab_len--;
+    if (tab_len == 0) arena_used = arena_live = 0;
+    else arena_compact();
+}
+
+/* Enter a pipeline whose stages are already running. A foreground job is
+ * waited for by the caller and only shows up again if it gets stopped.
+ */
+Job *job_add(pid_t pgid, const pid_t *pids, int npids, const char *cmdline, int foreground) {
+    if (npids <= 0) return NULL;
+    if (tab_len == tab_cap) {
+        int cap = tab_cap ? tab_cap * 2 : 16;
+        Job *tmp = realloc(tab, (size_t)cap * sizeof(*tmp));
+        if (!tmp) {
+            fprintf(stderr, "warning: cannot track job: out of memory\n");
+            return NULL;
+        }
+        tab = tmp;
+        tab_cap = cap;
+    }
+    Job *j = &tab[tab_len];
+    memset(j, 0, sizeof(*j));
+    if (arena_add(cmdline ? cmdline : "", &j->cmd_off) != 0) {
+        fprintf(stderr, "warning: cannot track job: out of memory\n");
+        return NULL;
+    }
+    j->state = JOB_RUNNING;
+    j->waited = foreground;
+    j->pgid = pgid;
+    j->pid = pids[npids - 1];
+    j->nlive = npids;
+    j->job_no = ++tab_len;
+    for (int i = 0; i < npids; i++) {
+        if (pidx_insert(pids[i], j->job_no - 1, i)) continue;
+        // untrack the stages already entered and give the slot back
+        while (--i >= 0) pidx_find(pids[i])->pid = -1;
+        tab_len--;
+        size_t len = strlen(arena + j->cmd_off) + 1;
+        arena_used -= len;
+        arena_live -= len;
+        fprintf(stderr, "warning: cannot track job: out of memory\n");
+        return NULL;
+    }
+    live_procs += npids;
+    if (announce && !foreground) {
+        printf("[%d] %d\n", j->job_no, (int)j->pid);
+        fflush(stdout);
+    }
+    return j;
+}
+
+Job *job_by_pid(pid_t pid) {
+    pid_ent *e = pidx_find(pid);
+    return e ? &tab[e->slot] : NULL;
+}
+
+Job *job_by_number(int job_no) {
+    if (job_no < 1 || job_no > tab_len || tab[job_no - 1].state == JOB_DONE) return NULL;
+    return &tab[job_no - 1];
+}
+
+// What fg and bg act on by default: the newest stopped job, else the newest job
+Job *job_current(void) {
+    Job *running = NULL;
+    for (int i = tab_len - 1; i >= 0; i--) {
+        if (tab[i].state == JOB_STOPPED) return &tab[i];
+        if (tab[i].state == JOB_RUNNING && !running) running = &tab[i];
+    }
+    return running;
+}
+
+const char *job_cmdline(const Job *j) {
+    return arena + j->cmd_off;
+}
+
+int jobs_live_procs(void) {
+    return live_procs;
+}
+
+static void mark_notify(Job *j) {
+    if (announce && !j->notify) {
+        j->notify = 1;
+        pending++;
+    }
+}
+
+// the user is acting on the job, so an unprinted notice about it is moot
+static void drop_notice(Job *j) {
+    if (j->notify) {
+        j->notify = 0;
+        pending--;
+        if (j->state == JOB_DONE) release(j);
+    }
+}
+
+static void finish(Job *j) {
+    j->state = JOB_DONE;
+    if (!j->waited) mark_notify(j);
+    if (!j->notify) release(j);
+}
+
+/* A tracked child exited, stopped or continued. Notices of finished and
+ * stopped jobs wait for the next prompt. ru, when given, is the exited
+ * child's resource usage and goes to the job's accounting if it has any.
+ */
+void job_child_status(pid_t pid, int status, const struct rusage *ru) {
+    pid_ent *e = pidx_find(pid);
+    if (!e) return;
+    Job *j = &tab[e->slot];
+    if (WIFSTOPPED(status)) {
+        if (!e->stopped) j->nstopped++;
+        e->stopped = 1;
+        j->stop_status = status;
+    } else if (WIFCONTINUED(status)) {
+        if (e->stopped) j->nstopped--;
+        e->stopped = 0;
+    } else {
+        if (e->stopped) j->nstopped--;
+        if (j->usage) {
+            stage_usage *u = &j->usage[e->stage];
+            clock_gettime(CLOCK_MONOTONIC, &u->end);
+            if (ru) u->ru = *ru;
+            u->reaped = 1;
+        }
+        e->pid = -1;
+        live_procs--;
+        if (pid == j->pid) j->status = status;
+        if (--j->nlive == 0) {
+            finish(j);
+            return;
+        }
+    }
+    if (j->state == JOB_RUNNING && j->nstopped == j->nlive) {
+        j->state = JOB_STOPPED;
+        mark_notify(j);
+    } else if (j->state == JOB_STOPPED && j->nstopped < j->nlive) {
+        j->state = JOB_RUNNING;
+    }
+}
+
+// drop the stages of a job whose children were reaped outside the table
+static void forget_stages(int slot) {
+    for (size_t i = 0; i < pidx_cap; i++) {
+        if (pidx[i].pid > 0 && pidx[i].slot == slot) {
+            pidx[i].pid = -1;
+            live_procs--;
+        }
+    }
+    tab[slot].nlive = 0;
+    finish(&tab[slot]);
+}
+
+// Collect every child that has changed state, without blocking
+void jobs_reap(void) {
+    int status;
+    struct rusage ru;
+    pid_t pid;
+    if (live_procs == 0) return;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+        job_child_status(pid, status, &ru);
+    }
+}
+
+/* While a tick is set, job_wait polls every interval instead of blocking
+ * in wait4(), calling fn between polls; the shell samples pipes this way. */
+static void (*tick_fn)(void *);
+static void  *tick_arg;
+static long   tick_ns;
+
+void jobs_set_tick(void (*fn)(void *), void *arg, int interval_ms) {
+    tick_fn = fn;
+    tick_arg = arg;
+    tick_ns = (long)interval_ms * 1000000L;
+}
+
+/* Block until every stage of j has exited or, under job control, until
+ * the job stops. No notice is printed for it finishing. Other children
+ * reaped meanwhile are recorded against their own jobs.
+ * Returns the last stage's exit status, or 128 + the stop signal.
+ */
+int job_wait(Job *j) {
+    int slot = (int)(j - tab);
+    int opts = job_control ? WUNTRACED | WCONTINUED : 0;
+    if (tick_fn) opts |= WNOHANG;
+    tab[slot].waited = 1;
+    drop_notice(&tab[slot]);
+    while (tab[slot].state == JOB_RUNNING) {
+        int status;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &status, opts, &ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            forget_stages(slot);
+            break;
+        }
+        if (pid == 0) {
+            tick_fn(tick_arg);
+            struct timespec ts = { 0, tick_ns };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        // a stage that read the terminal before the group was handed it
+        if (WIFSTOPPED(status) && (WSTOPSIG(status) == SIGTTIN || WSTOPSIG(status) == SIGTTOU) &&
+            job_by_pid(pid) == &tab[slot] && tcgetpgrp(tty) == tab[slot].pgid) {
+            kill(pid, SIGCONT);
+            continue;
+        }
+        job_child_status(pid, status, &ru);
+    }
+    j = &tab[slot];
+    j->waited = 0;
+    if (j->state == JOB_STOPPED) return 128 + WSTOPSIG(j->stop_status);
+    return WIFEXITED(j->status) ? WEXITSTATUS(j->status) : 128 + WTERMSIG(j->status);
+}
+
+static int continue_job(Job *j) {
+    int slot = (int)(j - tab);
+    // SIGCONT resumes every stage; clear them now rather than when each
+    // WCONTINUED arrives, so a wait that follows sees a running job
+    for (size_t i = 0; i < pidx_cap; i++) {
+        if (pidx[i].pid > 0 && pidx[i].slot == slot) pidx[i].stopped = 0;
+    }
+    j->nstopped = 0;
+    j->state = JOB_RUNNING;
+    if (kill(-j->pgid, SIGCONT) != 0) {
+        perror("kill");
+        return -1;
+    }
+    return 0;
+}
+
+/* Give j the terminal and wait for it, continuing it first if cont is set.
+ * The shell takes the terminal back when the job finishes or stops; a
+ * stopped job keeps its terminal modes for the next fg.
+ */
+int job_foreground(Job *j, int cont) {
+    int slot = (int)(j - tab);
+    int owns_tty = job_control && j->pgid > 0;
+    if (owns_tty) {
+        tcsetpgrp(tty, j->pgid);
+        if (cont && j->has_tmodes) tcsetattr(tty, TCSADRAIN, &j->tmodes);
+    }
+    if (cont && continue_job(j) != 0) {
+        if (owns_tty) tcsetpgrp(tty, shell_pgid);
+        return 1;
+    }
+    int rc = job_wait(j);
+    if (owns_tty) {
+        tcsetpgrp(tty, shell_pgid);
+        j = &tab[slot];
+        if (j->state == JOB_STOPPED) {
+            j->has_tmodes = tcgetattr(tty, &j->tmodes) == 0;
+            putchar('\n');      // the terminal echoed ^Z mid-line
+        } else if (WIFSIGNALED(j->status) && WTERMSIG(j->status) == SIGINT) {
+            putchar('\n');      // likewise ^C
+        }
+        tcsetattr(tty, TCSADRAIN, &shell_tmodes);
+    }
+    return rc;
+}
+
+int job_background(Job *j) {
+    if (j->state != JOB_STOPPED) {
+        fprintf(stderr, "bg: job %d already in background\n", j->job_no);
+        return 0;
+    }
+    drop_notice(j);
+    if (continue_job(j) != 0) return 1;
+    printf("[%d]+ %s &\n", j->job_no, job_cmdline(j));
+    return 0;
+}
+
+// Stopped jobs would never finish on their own: hang them up, then let them run
+void jobs_hangup_stopped(void) {
+    for (int i = 0; i < tab_len; i++) {
+        if (tab[i].state == JOB_STOPPED) {
+            kill(-tab[i].pgid, SIGHUP);
+            continue_job(&tab[i]);
+        }
+    }
+}
+
+void jobs_wait_all(void) {
+    for (int i = 0; i < tab_len; i++) {
+        if (tab[i].state == JOB_RUNNING) job_wait(&tab[i]);
+    }
+}
+
+int jobs_pending_notices(void) {
+    return pending;
+}
+
+int jobs_print_notices(void) {
+    if (pending == 0) return 0;
+    int printed = 0;
+    for (int i = 0; i < tab_len && pending > 0; i++) {
+        if (!tab[i].notify) continue;
+        tab[i].notify = 0;
+        pending--;
+        if (tab[i].state == JOB_RUNNING) continue;      // continued before we said anything
+        printf("[%d] + %s %s\n", tab[i].job_no, tab[i].state == JOB_DONE ? "done" : "stopped",
+               job_cmdline(&tab[i]));
+        printed++;
+        if (tab[i].state == JOB_DONE) release(&tab[i]);
+    }
+    fflush(stdout);
+    return printed;
+}
+
+void jobs_print(void) {
+    int any = 0;
+    for (int i = 0; i < tab_len; i++) {
+        if (tab[i].state != JOB_DONE) {
+            any = 1;
+            printf("[%d]+ %d %s %s\n", tab[i].job_no, (int)tab[i].pid,
+                   tab[i].state == JOB_STOPPED ? "stopped" : "running", job_cmdline(&tab[i]));
+        }
+    }
+    if (!any) {
+        printf("no active background processes\n");
+    }
+}
+
+#ifdef JOBS_STRESS
+/* Stress test: keep thousands of background children alive at once, then
+ * release them together and reap every one through the table.
+ * Build with: gcc -O2 -DJOBS_STRESS -Iinclude -o bin/jobs_stress src/jobs.c
+ * Usage: bin/jobs_stress [njobs]
+ */
+#include <time.h>
+#include <unistd.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 3000;
+    int gate[2];
+    if (pipe(gate) != 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    double t0 = now_sec();
+    int started = 0;
+    for (; started < n; started++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        if (pid == 0) {         // block until the gate closes
+            char c;
+            close(gate[1]);
+            while (read(gate[0], &c, 1) < 0 && errno == EINTR) {}
+            _exit(0);
+        }
+        char cmd[32];
+        snprintf(cmd, sizeof(cmd), "stress job %d", started);
+        if (!job_add(pid, &pid, 1, cmd, 0)) return 1;
+    }
+    double t_add = now_sec() - t0;
+
+    if (!job_by_number(started) || job_by_number(started)->pid <= 0) {
+        fprintf(stderr, "FAIL: job %d not found by number\n", started);
+        return 1;
+    }
+
+    close(gate[1]);
+    t0 = now_sec();
+    int reaped = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, 0)) > 0) {
+        if (!job_by_pid(pid)) {
+            fprintf(stderr, "FAIL: pid %d not in table\n", (int)pid);
+            return 1;
+        }
+        job_child_status(pid, 0, NULL);
+        reaped++;
+    }
+    double t_reap = now_sec() - t0;
+
+    if (reaped != started || tab_len != 0 || arena_used != 0 || live_procs != 0) {
+        fprintf(stderr, "FAIL: reaped %d of %d, %d slots left\n", reaped, started, tab_len);
+        return 1;
+    }
+    printf("%d concurrent jobs: add %.1f us/job (incl. fork), reap %.1f us/job; table empty\n",
+           started, t_add * 1e6 / started, t_reap * 1e6 / started);
+    return 0;
+}
+#endif
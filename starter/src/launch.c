@@ -0,0 +1,353 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE             // F_SETPIPE_SZ
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "launch.h"
+
+extern char **environ;
+
+/* Process launch engines. The fork engine copies the parent's page tables
+ * for every child; posix_spawn (vfork-style in glibc) shares the parent's
+ * memory until exec, so its cost does not grow with the shell's heap.
+ * Default is picked at build time (make LAUNCH=spawn) and can be
+ * overridden at startup with SHELL_LAUNCH=fork|spawn. */
+#ifdef LAUNCH_DEFAULT_SPAWN
+static launch_engine engine = LAUNCH_SPAWN;
+#else
+static launch_engine engine = LAUNCH_FORK;
+#endif
+
+void launch_init(void) {
+    const char *e = getenv("SHELL_LAUNCH");
+    if (!e) return;
+    if (strcmp(e, "spawn") == 0) engine = LAUNCH_SPAWN;
+    else if (strcmp(e, "fork") == 0) engine = LAUNCH_FORK;
+    else fprintf(stderr, "warning: unknown SHELL_LAUNCH '%s'\n", e);
+}
+
+/* Signals the shell ignores for itself (job control) go back to their
+ * defaults in every child; exec keeps SIG_IGN otherwise. */
+static sigset_t sigdefault;
+static int      sigdefault_set;
+
+#define LAUNCH_SIG_MAX 64
+
+void launch_set_sigdefault(const sigset_t *set) {
+    sigdefault = *set;
+    sigdefault_set = 1;
+}
+
+void launch_set_engine(launch_engine e) { engine = e; }
+launch_engine launch_get_engine(void) { return engine; }
+
+void launch_spec_init(launch_spec *ls) {
+    ls->act = ls->inline_act;
+    ls->nact = 0;
+    ls->cap = LAUNCH_INLINE_ACTIONS;
+    ls->pgid = -1;
+    ls->tty_fd = -1;
+}
+
+void launch_spec_free(launch_spec *ls) {
+    if (ls->act != ls->inline_act) free(ls->act);
+    ls->act = ls->inline_act;
+    ls->nact = 0;
+    ls->cap = LAUNCH_INLINE_ACTIONS;
+}
+
+static int add_action(launch_spec *ls, int op, int fd, int src) {
+    if (ls->nact == ls->cap) {
+        int cap = ls->cap * 2;
+        launch_action *act = malloc(cap * sizeof *act);
+        if (!act) {
+            perror("malloc");
+            return -1;
+        }
+        memcpy(act, ls->act, ls->nact * sizeof *act);
+        if (ls->act != ls->inline_act) free(ls->act);
+        ls->act = act;
+        ls->cap = cap;
+    }
+    ls->act[ls->nact].op = op;
+    ls->act[ls->nact].fd = fd;
+    ls->act[ls->nact].src = src;
+    ls->nact++;
+    return 0;
+}
+
+int launch_dup2(launch_spec *ls, int src, int fd) {
+    return add_action(ls, LAUNCH_DUP2, fd, src);
+}
+
+int launch_close(launch_spec *ls, int fd) {
+    return add_action(ls, LAUNCH_CLOSE, fd, -1);
+}
+
+// child side of fork: group, terminal, signal dispositions, descriptors
+static void child_setup(const launch_spec *ls) {
+    if (ls && ls->pgid >= 0 && setpgid(0, ls->pgid) != 0) {
+        perror("setpgid");
+        _exit(127);
+    }
+    // take the terminal before exec so the first read cannot race the parent
+    if (ls && ls->tty_fd >= 0) tcsetpgrp(ls->tty_fd, getpgrp());
+    for (int s = 1; sigdefault_set && s <= LAUNCH_SIG_MAX; s++) {
+        if (sigismember(&sigdefault, s) == 1) signal(s, SIG_DFL);
+    }
+    for (int i = 0; ls && i < ls->nact; i++) {
+        const launch_action *a = &ls->act[i];
+        if (a->op == LAUNCH_CLOSE) {
+            close(a->fd);
+        } else if (dup2(a->src, a->fd) < 0) {
+            perror("dup2");
+            _exit(127);
+        }
+    }
+}
+
+static pid_t launch_fork(const char *path, char *const argv[], const launch_spec *ls) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid > 0) return pid;
+
+    child_setup(ls);
+    execv(path, argv);
+    perror("execv");
+    _exit(127);
+}
+
+static pid_t launch_spawn(const char *path, char *const argv[], const launch_spec *ls) {
+    posix_spawn_file_actions_t fa;
+    if (posix_spawn_file_actions_init(&fa) != 0) {
+        perror("posix_spawn_file_actions_init");
+        return -1;
+    }
+    for (int i = 0; ls && i < ls->nact; i++) {
+        const launch_action *a = &ls->act[i];
+        if (a->op == LAUNCH_CLOSE) posix_spawn_file_actions_addclose(&fa, a->fd);
+        else posix_spawn_file_actions_adddup2(&fa, a->src, a->fd);
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short flags = 0;
+    if (ls && ls->pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, ls->pgid);
+    }
+    if (sigdefault_set) {
+        flags |= POSIX_SPAWN_SETSIGDEF;
+        posix_spawnattr_setsigdefault(&attr, &sigdefault);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int rc = posix_spawn(&pid, path, &fa, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0) {
+        fprintf(stderr, "posix_spawn: %s: %s\n", path, strerror(rc));
+        return -1;
+    }
+    return pid;
+}
+
+pid_t launch_process(const char *path, char *const argv[], const launch_spec *ls) {
+    pid_t pid = engine == LAUNCH_SPAWN ? launch_spawn(path, argv, ls)
+                                       : launch_fork(path, argv, ls);
+    // set the group from this side too so it exists before the next stage joins
+    if (pid > 0 && ls && ls->pgid >= 0) setpgid(pid, ls->pgid ? ls->pgid : pid);
+    return pid;
+}
+
+/* pipe() with its capacity set to size bytes when size > 0 (the kernel
+ * rounds up to a power-of-two number of pages). A capacity the kernel
+ * refuses, e.g. over /proc/sys/fs/pipe-max-size, leaves the pipe at its
+ * default and returns 1 with errno set, so the caller can warn once. */
+int launch_pipe(int fds[2], int size) {
+    if (pipe(fds) != 0) return -1;
+    if (size > 0 && fcntl(fds[1], F_SETPIPE_SZ, size) < 0) return 1;
+    return 0;
+}
+
+int launch_pipe_size(int fd) {
+    return fcntl(fd, F_GETPIPE_SZ);
+}
+
+/* A stage that is a function of the shell (a builtin in a pipeline or in
+ * the background) always forks, whatever the engine: there is nothing to
+ * exec. The child flushes stdio and leaves with _exit() so the shell's
+ * atexit handlers do not run twice. Callers flush stdout before this. */
+pid_t launch_function(int (*fn)(int, char **), int argc, char **argv, const launch_spec *ls) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        child_setup(ls);
+        int rc = fn(argc, argv);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(rc);
+    }
+    if (ls && ls->pgid >= 0) setpgid(pid, ls->pgid ? ls->pgid : pid);
+    return pid;
+}
+
+#ifdef LAUNCH_BENCH
+/* Spawn-latency benchmark: fork vs posix_spawn of /bin/true, with the
+ * parent holding heap_mb of touched memory to mimic a long-lived shell.
+ * Build with: gcc -O2 -DLAUNCH_BENCH -Iinclude -o bin/launch_bench src/launch.c
+ * Usage: bin/launch_bench [iterations] [heap_mb]
+ */
+#include <sys/wait.h>
+#include <time.h>
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double bench_engine(launch_engine e, int iters) {
+    char *argv[] = {"true", NULL};
+    launch_set_engine(e);
+    double start = now_us();
+    for (int i = 0; i < iters; i++) {
+        pid_t pid = launch_process("/bin/true", argv, NULL);
+        if (pid < 0) exit(1);
+        waitpid(pid, NULL, 0);
+    }
+    return (now_us() - start) / iters;
+}
+
+int main(int argc, char **argv) {
+    int iters = argc > 1 ? atoi(argv[1]) : 2000;
+    size_t heap_mb = argc > 2 ? (size_t)atol(argv[2]) : 256;
+
+    char *heap = malloc(heap_mb << 20);
+    if (heap_mb && !heap) {
+        perror("malloc");
+        return 1;
+    }
+    memset(heap, 1, heap_mb << 20);
+
+    printf("%d launches of /bin/true, parent heap %zu MB\n", iters, heap_mb);
+    printf("fork + execv:  %8.1f us/launch\n", bench_engine(LAUNCH_FORK, iters));
+    printf("posix_spawn:   %8.1f us/launch\n", bench_engine(LAUNCH_SPAWN, iters));
+    free(heap);
+    return 0;
+}
+#endif
+
+#ifdef PIPE_BENCH
+/* Pipe capacity benchmark: size_mb of data through a chain of 2..8
+ * processes (a writer, read/write relays, a reader that discards), once per
+ * pipe capacity. Reports throughput and the chain's voluntary context
+ * switches, i.e. how often a stage blocked on a full or empty pipe.
+ * Build with: gcc -O2 -DPIPE_BENCH -Iinclude -o bin/pipe_bench src/launch.c
+ * Usage: bin/pipe_bench [size_mb] [chunk_kb]
+ */
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+static long long bench_bytes;
+static size_t    bench_chunk;
+
+static int writer(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    char *buf = malloc(bench_chunk);
+    memset(buf, 'x', bench_chunk);
+    for (long long left = bench_bytes; left > 0; ) {
+        size_t n = left < (long long)bench_chunk ? (size_t)left : bench_chunk;
+        ssize_t w = write(STDOUT_FILENO, buf, n);
+        if (w < 0) return 1;
+        left -= w;
+    }
+    return 0;
+}
+
+// relay (argv[0] "relay") copies stdin to stdout; the reader only drains
+static int relay(int argc, char **argv) {
+    (void)argc;
+    int copy = strcmp(argv[0], "relay") == 0;
+    char *buf = malloc(bench_chunk);
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buf, bench_chunk)) > 0) {
+        for (ssize_t off = 0; copy && off < n; ) {
+            ssize_t w = write(STDOUT_FILENO, buf + off, (size_t)(n - off));
+            if (w < 0) return 1;
+            off += w;
+        }
+    }
+    return n < 0;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_chain(int stages, int size) {
+    char *relay_argv[] = {"relay", NULL}, *reader_argv[] = {"reader", NULL};
+    int prev = -1, cap = 0;
+    fflush(stdout);     // the stages are forks, they flush on the way out
+    double t = now_s();
+    for (int i = 0; i < stages; i++) {
+        int pfd[2] = {-1, -1};
+        if (i < stages - 1) {
+            if (launch_pipe(pfd, size) < 0) exit(1);
+            cap = launch_pipe_size(pfd[1]);
+        }
+        launch_spec ls;
+        launch_spec_init(&ls);
+        if (prev >= 0)   launch_dup2(&ls, prev, STDIN_FILENO);
+        if (pfd[1] >= 0) launch_dup2(&ls, pfd[1], STDOUT_FILENO);
+        if (prev >= 0)   launch_close(&ls, prev);
+        if (pfd[0] >= 0) launch_close(&ls, pfd[0]);
+        if (pfd[1] >= 0) launch_close(&ls, pfd[1]);
+        if (i == 0) launch_function(writer, 0, NULL, &ls);
+        else if (i < stages - 1) launch_function(relay, 1, relay_argv, &ls);
+        else launch_function(relay, 1, reader_argv, &ls);
+        launch_spec_free(&ls);
+        if (prev >= 0)   close(prev);
+        if (pfd[1] >= 0) close(pfd[1]);
+        prev = pfd[0];
+    }
+    long vcsw = 0, ivcsw = 0;
+    struct rusage ru;
+    for (int i = 0; i < stages; i++) {
+        if (wait4(-1, NULL, 0, &ru) < 0) break;
+        vcsw += ru.ru_nvcsw;
+        ivcsw += ru.ru_nivcsw;
+    }
+    t = now_s() - t;
+    printf("%d stages  pipe %5dk  %6.2f GB/s  vcsw %8ld  ivcsw %7ld\n",
+           stages, cap / 1024, bench_bytes / t / 1e9, vcsw, ivcsw);
+}
+
+int main(int argc, char **argv) {
+    bench_bytes = (long long)(argc > 1 ? atof(argv[1]) : 1024) * (1 << 20);
+    bench_chunk = (size_t)(argc > 2 ? atoi(argv[2]) : 64) << 10;
+    static const int sizes[] = { 4096, 0, 256 << 10, 1 << 20 };     // 0: default
+
+    printf("%lld MB through each chain, %zu KB reads and writes\n", bench_bytes >> 20, bench_chunk >> 10);
+    for (int stages = 2; stages <= 8; stages *= 2) {
+        for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) run_chain(stages, sizes[k]);
+    }
+    return 0;
+}
+#endif
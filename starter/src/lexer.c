@@ -1,186 +1,881 @@
+#define _POSIX_C_SOURCE 200809L
 #include "lexer.h"
+#include "pathglob.h"
 #include "prompt.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-/* Read a whole line from stdin into a dynamically-grown buffer.
- * The returned buffer is NUL-terminated and has NO trailing newline.
- * Caller must free() the returned pointer.
+extern char **environ;
+
+/* Buffered line reader. Input is pulled with read() into one buffer that
+ * grows geometrically and is reused for every line: a terminal hands over
+ * a line per read(), files and pipes are read READER_BLOCK bytes at a time.
+ * Lines are NUL-terminated in place, so reading one costs no allocation.
  */
-char *get_input(void) {
-    char *buffer = NULL;
-    int bufsize = 0;
+#define READER_BLOCK 65536
 
-    /* Small chunked read to avoid getline() portability issues. */
-    char line[5];
-    while (fgets(line, (int)sizeof(line), stdin) != NULL) {
-        int addby = 0;
-        char *newln = strchr(line, '\n');
-        if (newln != NULL) {
-            addby = (int)(newln - line);
-        } else {
-            addby = (int)sizeof(line) - 1;
-        }
+static struct {
+    int    fd;
+    char  *buf;
+    size_t cap;
+    size_t start;   /* first unconsumed byte */
+    size_t scan;    /* bytes from start already known to hold no newline */
+    size_t end;     /* one past the last byte read */
+    int    eof;
+} rd = { STDIN_FILENO, NULL, 0, 0, 0, 0, 0 };
 
-        char *tmp = (char *)realloc(buffer, (size_t)bufsize + (size_t)addby);
-        if (!tmp) {
-            free(buffer);
-            return NULL;
-        }
-        buffer = tmp;
+static int (*reader_wait)(int fd);
 
-        memcpy(&buffer[bufsize], line, (size_t)addby);
-        bufsize += addby;
+/* Call fn(fd) before each blocking read(); it returns once fd is readable
+ * (0) or on error (-1). The shell uses it to service SIGCHLD while idle.
+ */
+void reader_set_wait(int (*fn)(int fd)) {
+    reader_wait = fn;
+}
+
+/* Run the installed hook for another reader of fd (the line editor). */
+int reader_wait_readable(int fd) {
+    return reader_wait ? reader_wait(fd) : 0;
+}
+
+/* Read lines from fd from now on, discarding anything still buffered. */
+void reader_init(int fd) {
+    free(rd.buf);
+    rd.fd = fd;
+    rd.buf = NULL;
+    rd.cap = rd.start = rd.scan = rd.end = 0;
+    rd.eof = 0;
+}
 
-        if (newln != NULL) break; /* stop at newline */
+static int reader_fill(void) {
+    if (rd.start > 0) {
+        memmove(rd.buf, rd.buf + rd.start, rd.end - rd.start);
+        rd.end -= rd.start;
+        rd.start = 0;
     }
+    if (rd.cap - rd.end < 2) {
+        size_t cap = rd.cap ? rd.cap * 2 : (isatty(rd.fd) ? 1024 : READER_BLOCK + 1);
+        char *tmp = (char *)realloc(rd.buf, cap);
+        if (!tmp) return -1;
+        rd.buf = tmp;
+        rd.cap = cap;
+    }
+
+    if (reader_wait_readable(rd.fd) != 0) return -1;
 
-    /* EOF with no data: return empty string for convenience */
-    if (buffer == NULL && feof(stdin)) {
-        buffer = (char *)malloc(1);
-        if (buffer) buffer[0] = '\0';
-        return buffer;
+    ssize_t n;
+    do {
+        n = read(rd.fd, rd.buf + rd.end, rd.cap - rd.end - 1); /* keep room for NUL */
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        perror("read");
+        return -1;
     }
+    if (n == 0) rd.eof = 1;
+    rd.end += (size_t)n;
+    return 0;
+}
 
-    /* NUL-terminate */
-    char *tmp = (char *)realloc(buffer, (size_t)bufsize + 1u);
-    if (!tmp) {
-        free(buffer);
-        return NULL;
+/* Return the next line without its newline, or NULL at EOF.
+ * The line lives in the reader's buffer and is valid until the next call.
+ */
+char *read_line(size_t *len) {
+    for (;;) {
+        char *from = rd.buf + rd.start + rd.scan;
+        char *nl = rd.buf ? (char *)memchr(from, '\n', rd.end - rd.start - rd.scan) : NULL;
+        if (nl) {
+            char *line = rd.buf + rd.start;
+            *nl = '\0';
+            if (len) *len = (size_t)(nl - line);
+            rd.start = (size_t)(nl - rd.buf) + 1u;
+            rd.scan = 0;
+            return line;
+        }
+        if (rd.eof) {
+            if (rd.start == rd.end) return NULL;
+            char *line = rd.buf + rd.start;   /* last line had no newline */
+            rd.buf[rd.end] = '\0';
+            if (len) *len = rd.end - rd.start;
+            rd.start = rd.end;
+            rd.scan = 0;
+            return line;
+        }
+        rd.scan = rd.end - rd.start;
+        if (reader_fill() != 0) return NULL;
     }
-    buffer = tmp;
-    buffer[bufsize] = '\0';
-    return buffer;
 }
 
-/* Create an empty tokenlist. */
-tokenlist *new_tokenlist(void) {
-    tokenlist *tokens = (tokenlist *)malloc(sizeof(tokenlist));
-    if (!tokens) return NULL;
+/* Line tokenizer: one pass over the line, a small state machine for
+ * plain text, '...', "..." and backslashes. Each token's text is written
+ * NUL-terminated into lt->arena, quotes and escapes already removed, and
+ * recorded as an (offset, length) span. Control operators (; & | && || ( ))
+ * are tokens of their own wherever they appear unquoted, so `a&&b;c` is
+ * five. A `#` starting a word outside quotes comments out the rest of
+ * the line (`echo a#b # c` is two words). A $NAME, ${NAME} or leading ~ is not looked up here: it is
+ * recorded as an expansion site of the word, and expand_words() later
+ * writes the word with the values in place straight into the arena. All
+ * buffers are kept between lines, so a warmed-up linetok tokenizes
+ * without allocating.
+ */
+static int arena_reserve(linetok *lt, size_t extra) {
+    if (lt->used + extra <= lt->cap) return 0;
+    size_t cap = lt->cap ? lt->cap : 256;
+    while (cap < lt->used + extra) cap *= 2;
+    char *tmp = (char *)realloc(lt->arena, cap);
+    if (!tmp) return -1;
+    lt->arena = tmp;
+    lt->cap = cap;
+    return 0;
+}
 
-    tokens->size = 0;
-    tokens->items = (char **)malloc(sizeof(char *));
-    if (!tokens->items) {
-        free(tokens);
-        return NULL;
+static span *push_span(linetok *lt) {
+    if (lt->size == lt->span_cap) {
+        size_t cap = lt->span_cap ? lt->span_cap * 2 : 16;
+        span *sp = (span *)realloc(lt->spans, cap * sizeof(*sp));
+        if (!sp) return NULL;
+        lt->spans = sp;
+        lt->span_cap = cap;
     }
-    tokens->items[0] = NULL; /* make NULL-terminated */
-    return tokens;
+    span *s = &lt->spans[lt->size++];
+    memset(s, 0, sizeof(*s));
+    return s;
 }
 
-/* Append a copy of 'item' to tokens->items. */
-void add_token(tokenlist *tokens, char *item) {
-    if (!tokens || !item) return;
+static int push_exp(linetok *lt, size_t at, size_t name, size_t name_len, int kind, int quoted) {
+    if (lt->nexps == lt->exp_cap) {
+        size_t cap = lt->exp_cap ? lt->exp_cap * 2 : 16;
+        expansion *e = (expansion *)realloc(lt->exps, cap * sizeof(*e));
+        if (!e) return -1;
+        lt->exps = e;
+        lt->exp_cap = cap;
+    }
+    expansion e = { at, name, name_len, kind, quoted };
+    lt->exps[lt->nexps++] = e;
+    return 0;
+}
 
-    int i = (int)tokens->size;
-    char **new_items = (char **)realloc(tokens->items, (size_t)(i + 2) * sizeof(char *));
-    if (!new_items) return;
-    tokens->items = new_items;
+static int push_qmeta(linetok *lt, size_t at) {
+    if (lt->nqmeta == lt->qmeta_cap) {
+        size_t cap = lt->qmeta_cap ? lt->qmeta_cap * 2 : 16;
+        size_t *q = (size_t *)realloc(lt->qmeta, cap * sizeof(*q));
+        if (!q) return -1;
+        lt->qmeta = q;
+        lt->qmeta_cap = cap;
+    }
+    lt->qmeta[lt->nqmeta++] = at;
+    return 0;
+}
 
-    tokens->items[i] = (char *)malloc(strlen(item) + 1u);
-    if (!tokens->items[i]) return;
+static int is_glob_char(char c) {
+    return c == '*' || c == '?' || c == '[';
+}
 
-    strcpy(tokens->items[i], item);
-    tokens->items[i + 1] = NULL; /* keep NULL-terminated */
+// a quoted byte going to offset at of the word: a pattern character is noted
+static int quoted_byte(linetok *lt, char c, size_t at) {
+    return (is_glob_char(c) || c == ']') ? push_qmeta(lt, at) : 0;
+}
 
-    tokens->size += 1u;
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
 }
 
-/* Tokenize by whitespace (space, tab, CR, NL). */
-tokenlist *get_tokens(char *input) {
-    if (!input) return new_tokenlist();
+static int is_var_name_char(char c) {
+    return (c=='_') || (c>='0' && c<='9') || (c>='A' && c<='Z') || (c>='a' && c<='z');
+}
 
-    char *buf = (char *)malloc(strlen(input) + 1u);
-    if (!buf) return new_tokenlist();
-    strcpy(buf, input);
+/* The operator starting at line[i] and its length, or TOK_WORD. A `&`
+ * followed by `>` starts the &> redirection instead. */
+static int operator_at(const char *line, size_t i, size_t len, size_t *oplen) {
+    char next = i + 1 < len ? line[i + 1] : '\0';
+    *oplen = 1;
+    switch (line[i]) {
+    case ';': return TOK_SEMI;
+    case '(': return TOK_LPAREN;
+    case ')': return TOK_RPAREN;
+    case '|':
+        if (next != '|') return TOK_PIPE;
+        *oplen = 2;
+        return TOK_OR;
+    case '&':
+        if (next == '>') return TOK_WORD;
+        if (next != '&') return TOK_AMP;
+        *oplen = 2;
+        return TOK_AND;
+    }
+    return TOK_WORD;
+}
 
-    tokenlist *tokens = new_tokenlist();
-    if (!tokens) {
-        free(buf);
-        return NULL;
+// the ) closing a $( whose text starts at in[i], or len
+static size_t closing_paren(const char *in, size_t len, size_t i) {
+    int depth = 1;
+    for (; i < len; i++) {
+        char c = in[i];
+        if (c == '\\') {
+            i++;
+        } else if (c == '\'') {
+            while (++i < len && in[i] != '\'') {}
+        } else if (c == '"') {
+            while (++i < len && in[i] != '"') {
+                if (in[i] == '\\') i++;
+            }
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && --depth == 0) {
+            return i;
+        }
     }
+    return len;
+}
 
-    /* Split on any whitespace (more robust than just space). */
-    char *tok = strtok(buf, " \t\r\n");
-    while (tok != NULL) {
-        add_token(tokens, tok);
-        tok = strtok(NULL, " \t\r\n");
+/* $NAME, ${NAME} or $(command) at in[*i]: records it to go at offset `at`
+ * of the word being written and moves past it. Returns 0 if `$` is just a
+ * character here, 1 when recorded, -1 on error. */
+static int dollar(linetok *lt, const char *in, size_t len, size_t *i, size_t at, int quoted) {
+    size_t k = *i + 1;
+    if (k < len && in[k] == '(') {
+        size_t end = closing_paren(in, len, k + 1);
+        if (end == len) {
+            fprintf(stderr, "error: unterminated $(\n");
+            return -1;
+        }
+        *i = end + 1;
+        return push_exp(lt, at, k + 1, end - k - 1, EXP_CMD, quoted) == 0 ? 1 : -1;
+    }
+    if (k < len && in[k] == '{') {
+        size_t name = k + 1, end = name;
+        while (end < len && in[end] != '}') end++;
+        int ok = end < len && end > name && !(in[name] >= '0' && in[name] <= '9');
+        for (size_t c = name; ok && c < end; c++) ok = is_var_name_char(in[c]);
+        if (!ok) {
+            fprintf(stderr, "error: bad substitution: %.*s\n", (int)(end + (end < len) - *i), in + *i);
+            return -1;
+        }
+        *i = end + 1;
+        return push_exp(lt, at, name, end - name, EXP_VAR, quoted) == 0 ? 1 : -1;
     }
+    if (k >= len || !is_var_name_char(in[k]) || (in[k] >= '0' && in[k] <= '9')) return 0;
+    size_t end = k;
+    while (end < len && is_var_name_char(in[end])) end++;
+    *i = end;
+    return push_exp(lt, at, k, end - k, EXP_VAR, quoted) == 0 ? 1 : -1;
+}
 
-    free(buf);
-    return tokens;
+// one word from in[*i], written at out + *o; -1 after reporting an error
+static int lex_word(linetok *lt, const char *in, size_t len, size_t *i, size_t *o, span *sp) {
+    char *out = lt->arena;
+    size_t start = *o, p = *i, w = *o;
+    size_t lit = (size_t)-1;
+    char prev = '\0';       // previous byte if it was typed as is, for 2>&1 and >|
+    int rc;
+
+#define NOT_LITERAL() do { if (lit == (size_t)-1) lit = w - start; } while (0)
+
+    while (p < len) {
+        char c = in[p];
+        if (c == '\'') {
+            NOT_LITERAL();
+            sp->quoted = 1;
+            size_t end = p + 1;
+            while (end < len && in[end] != '\'') end++;
+            if (end == len) {
+                fprintf(stderr, "error: unterminated '\n");
+                return -1;
+            }
+            memcpy(out + w, in + p + 1, end - p - 1);
+            for (size_t k = p + 1; k < end; k++) {
+                if (quoted_byte(lt, in[k], w - start + (k - p - 1)) != 0) return -1;
+            }
+            w += end - p - 1;
+            p = end + 1;
+            prev = '\0';
+        } else if (c == '"') {
+            NOT_LITERAL();
+            sp->quoted = 1;
+            for (p++; p < len && in[p] != '"'; ) {
+                if (in[p] == '\\' && p + 1 < len && strchr("$`\"\\\n", in[p + 1])) {
+                    if (in[p + 1] != '\n') out[w++] = in[p + 1];
+                    p += 2;
+                } else if (in[p] == '$' && (rc = dollar(lt, in, len, &p, w - start, 1)) != 0) {
+                    if (rc < 0) return -1;
+                } else {
+                    if (quoted_byte(lt, in[p], w - start) != 0) return -1;
+                    out[w++] = in[p++];
+                }
+            }
+            if (p == len) {
+                fprintf(stderr, "error: unterminated \"\n");
+                return -1;
+            }
+            p++;
+            prev = '\0';
+        } else if (c == '\\') {
+            NOT_LITERAL();
+            sp->quoted = 1;
+            if (p + 1 < len) {
+                if (quoted_byte(lt, in[p + 1], w - start) != 0) return -1;
+                if (in[p + 1] != '\n') out[w++] = in[p + 1];     // \newline joins lines
+                p += 2;
+            } else {
+                out[w++] = in[p++];
+            }
+            prev = '\0';
+        } else {
+            if (is_blank(c) || c == ';' || c == '(' || c == ')') break;
+            if (c == '|' && prev != '>') break;                  // >| is a redirection
+            if (c == '&' && prev != '>' && prev != '<' &&          // 2>&1, <&3
+                (w > start || p + 1 >= len || in[p + 1] != '>')) break;
+            if (c == '$') {
+                size_t at = w - start;
+                if ((rc = dollar(lt, in, len, &p, at, 0)) < 0) return -1;
+                if (rc > 0) {
+                    NOT_LITERAL();
+                    prev = '\0';
+                    continue;
+                }
+            }
+            if (c == '~' && w == start && !sp->quoted &&
+                (p + 1 == len || in[p + 1] == '/' || is_blank(in[p + 1]) || strchr(";&|()", in[p + 1]))) {
+                NOT_LITERAL();
+                if (push_exp(lt, 0, 0, 0, EXP_HOME, 0) != 0) return -1;
+                p++;
+                prev = '\0';
+                continue;
+            }
+            if (is_glob_char(c)) sp->glob = 1;
+            out[w++] = c;
+            p++;
+            prev = c;
+        }
+    }
+#undef NOT_LITERAL
+    sp->lit = lit == (size_t)-1 ? w - start : lit;
+    out[w++] = '\0';
+    *i = p;
+    *o = w;
+    return 0;
 }
 
-/* Free all token strings and the tokenlist itself. */
-void free_tokens(tokenlist *tokens) {
-    if (!tokens) return;
-    for (int i = 0; i < (int)tokens->size; i++) {
-        free(tokens->items[i]);
+/* Returns the number of tokens, or -1. */
+int tokenize_line(linetok *lt, const char *line, size_t len) {
+    lt->used = 0;
+    lt->size = 0;
+    lt->nexps = 0;
+    lt->nqmeta = 0;
+    lt->nfields = 0;
+    // the line copy, then tokens of at most one byte per input byte plus a NUL
+    if (arena_reserve(lt, 3 * len + 2u) != 0) return -1;
+    memcpy(lt->arena, line, len);
+    lt->arena[len] = '\0';
+    const char *in = lt->arena;
+    size_t o = len + 1u, i = 0;
+
+    while (i < len) {
+        if (is_blank(in[i])) {
+            i++;
+            continue;
+        }
+        if (in[i] == '#') break;
+        span *sp = push_span(lt);
+        if (!sp) return -1;
+        sp->off = o;
+        sp->src = i;
+        sp->exp = lt->nexps;
+        sp->qm = (unsigned)lt->nqmeta;
+        size_t oplen;
+        sp->op = operator_at(in, i, len, &oplen);
+        if (sp->op != TOK_WORD) {
+            memcpy(lt->arena + o, in + i, oplen);
+            o += oplen;
+            i += oplen;
+            lt->arena[o++] = '\0';
+        } else if (lex_word(lt, in, len, &i, &o, sp) != 0) {
+            return -1;
+        }
+        sp->len = o - 1 - sp->off;
+        sp->nexp = lt->nexps - sp->exp;
+        sp->nqm = (unsigned)(lt->nqmeta - sp->qm);
+        sp->src_end = i;
     }
-    free(tokens->items);
-    free(tokens);
+    lt->used = o;
+    return (int)lt->size;
 }
 
-/* Tokenize input into an array of strings.
- * Returns the number of tokens found, or -1 on error.
- * The tokens array will be populated with heap-allocated strings.
- */
-int tokenize(const char *input, char **tokens, int max_tokens) {
-    if (!input || !tokens || max_tokens <= 0) return -1;
-    
-    char *buf = (char *)malloc(strlen(input) + 1u);
-    if (!buf) return -1;
-    strcpy(buf, input);
-    
-    int count = 0;
-    char *tok = strtok(buf, " \t\r\n");
-    while (tok != NULL && count < max_tokens) {
-        tokens[count] = (char *)malloc(strlen(tok) + 1u);
-        if (!tokens[count]) {
-            // Clean up already allocated tokens
-            for (int i = 0; i < count; i++) {
-                free(tokens[i]);
-                tokens[i] = NULL;
+static char *(*run_command)(const char *cmd, size_t len, size_t *out_len);
+
+void expand_set_command(char *(*run)(const char *cmd, size_t len, size_t *out_len)) {
+    run_command = run;
+}
+
+/* An expansion's value and length; *owned is set when the caller has to
+ * free it (command output). */
+static const char *exp_value(const linetok *lt, const expansion *e, size_t *len, char **owned) {
+    const char *name = lt->arena + e->name;
+    *owned = NULL;
+    if (e->kind == EXP_CMD) {
+        char *out = run_command ? run_command(name, e->name_len, len) : NULL;
+        if (!out) {
+            *len = 0;
+            return "";
+        }
+        while (*len > 0 && out[*len - 1] == '\n') (*len)--;    // trailing newlines go
+        *owned = out;
+        return out;
+    }
+    const char *v = NULL;
+    if (e->kind == EXP_HOME) {
+        v = getenv("HOME");
+    } else {
+        // the name is not NUL-terminated in the line copy: getenv() by hand
+        for (char **env = environ; env && *env && !v; env++) {
+            if (**env == *name && strncmp(*env, name, e->name_len) == 0 && (*env)[e->name_len] == '=') {
+                v = *env + e->name_len + 1;
             }
-            free(buf);
+        }
+    }
+    if (!v) v = "";
+    *len = strlen(v);
+    return v;
+}
+
+static int is_ifs(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static span *push_field(linetok *lt) {
+    if (lt->nfields == lt->field_cap) {
+        size_t cap = lt->field_cap ? lt->field_cap * 2 : 16;
+        span *f = (span *)realloc(lt->fields, cap * sizeof(*f));
+        if (!f) return NULL;
+        lt->fields = f;
+        char **it = (char **)realloc(lt->field_items, (cap + 1) * sizeof(*it));
+        if (!it) return NULL;
+        lt->field_items = it;
+        lt->field_cap = cap;
+    }
+    span *f = &lt->fields[lt->nfields++];
+    memset(f, 0, sizeof(*f));
+    return f;
+}
+
+/* Pathname expansion of the pattern at lt->arena + *base: each match,
+ * in order, becomes a field written from *base on. Returns the number of
+ * matches (with none the word stays as it is), or -1. */
+static long glob_fields(linetok *lt, size_t *base) {
+    char **match;
+    size_t n = pathglob(lt->arena + *base, &match);
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(match[i]);
+        if (arena_reserve(lt, (*base - lt->used) + len + 1u) != 0) return -1;
+        span *f = push_field(lt);
+        if (!f) return -1;
+        memcpy(lt->arena + *base, match[i], len + 1u);
+        f->off = *base;
+        f->len = len;
+        f->quoted = 1;          // a file name is never an operator or a redirection
+        *base += len + 1u;
+    }
+    return (long)n;
+}
+
+// drop the escaping backslashes of s[0..len); returns the new length
+static size_t unescape(char *s, size_t len) {
+    size_t o = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\\' && i + 1 < len) i++;
+        s[o++] = s[i];
+    }
+    s[o] = '\0';
+    return o;
+}
+
+/* The field written at *base: its matches if it is a pattern that
+ * matched, else itself, escapes removed. *base moves past it. */
+static int end_field(linetok *lt, const span *sp, size_t *base, size_t d, int first, int pattern, int escaped) {
+    lt->arena[*base + d] = '\0';
+    if (pattern) {
+        long n = glob_fields(lt, base);
+        if (n != 0) return n < 0 ? -1 : 0;
+    }
+    if (escaped) d = unescape(lt->arena + *base, d);
+    span *f = push_field(lt);
+    if (!f) return -1;
+    f->off = *base;
+    f->len = d;
+    f->lit = first ? (sp->lit < d ? sp->lit : d) : 0;
+    f->quoted = sp->quoted;
+    *base += d + 1u;
+    return 0;
+}
+
+/* Fields of one word with expansions or an unquoted * ? [. The text
+ * between the sites and the values are written once, as NUL-terminated
+ * fields at the end of the arena. An unquoted value is split at blanks,
+ * tabs and newlines, so one word can give several fields or none at all
+ * (an unset $X on its own); anything quoted keeps a field even when empty.
+ *
+ * A field with an unquoted * ? or [ from the word or from an unquoted
+ * value is a pattern. While one is possible, quoted metacharacters and
+ * every backslash are written escaped, as the pattern needs them; the
+ * escapes go again if it is not a pattern or matches nothing. */
+static int expand_word(linetok *lt, const span *sp, int split) {
+    size_t base = lt->used;         // start of the field being written
+    size_t d = 0, from = 0;
+    unsigned q = 0;                 // the next of the word's quoted metacharacters
+    int present = sp->quoted || sp->len > 0, first = 1;
+    int esc = split && sp->glob, pattern = 0, escaped = 0;
+    for (size_t k = 0; split && !esc && k < sp->nexp; k++) {
+        const expansion *e = &lt->exps[sp->exp + k];
+        esc = !e->quoted && e->kind != EXP_HOME;
+    }
+
+    for (size_t k = 0; k <= sp->nexp; k++) {
+        const expansion *e = k < sp->nexp ? &lt->exps[sp->exp + k] : NULL;
+        size_t at = e ? e->at : sp->len, vl = 0;
+        char *owned = NULL;
+        const char *v = e ? exp_value(lt, e, &vl, &owned) : "";
+        // v may be environment memory; the word is in the arena, which may move
+        if (arena_reserve(lt, (base - lt->used) + d + 2 * (at - from) + 3 * vl + 1u) != 0) {
+            free(owned);
             return -1;
         }
-        strcpy(tokens[count], tok);
-        count++;
-        tok = strtok(NULL, " \t\r\n");
+        if (!esc) {
+            memcpy(lt->arena + base + d, lt->arena + sp->off + from, at - from);
+            d += at - from;
+        } else {
+            for (size_t c = from; c < at; c++) {
+                char ch = lt->arena[sp->off + c];
+                int quoted = q < sp->nqm && lt->qmeta[sp->qm + q] == c;
+                q += quoted;
+                if (quoted || ch == '\\') {
+                    lt->arena[base + d++] = '\\';
+                    escaped = 1;
+                } else if (is_glob_char(ch)) {
+                    pattern = 1;
+                }
+                lt->arena[base + d++] = ch;
+            }
+        }
+        from = at;
+        int literal = e && (e->quoted || e->kind == EXP_HOME);   // its * ? [ match themselves
+        for (size_t c = 0; c < vl; c++) {
+            if (e->quoted || !split || !is_ifs(v[c])) {
+                if (esc && (v[c] == '\\' || (literal && (is_glob_char(v[c]) || v[c] == ']')))) {
+                    lt->arena[base + d++] = '\\';
+                    escaped = 1;
+                } else if (esc && is_glob_char(v[c])) {
+                    pattern = 1;
+                }
+                lt->arena[base + d++] = v[c];
+                present = 1;
+                continue;
+            }
+            if (present) {
+                // end of a field: the next one starts after its NUL (or its matches)
+                if (end_field(lt, sp, &base, d, first, pattern, escaped) != 0 ||
+                    arena_reserve(lt, (base - lt->used) + 3 * (vl - c) + 1u) != 0) {
+                    free(owned);
+                    return -1;
+                }
+                d = 0;
+                first = 0;
+                present = pattern = escaped = 0;
+            }
+        }
+        free(owned);
     }
-    
-    free(buf);
-    return count;
+    if (present && end_field(lt, sp, &base, d, first, pattern, escaped) != 0) return -1;
+    lt->used = base;
+    return 0;
+}
+
+// an unquoted redirection operator without its target: [n]< [n]> >> >| <<< <& >& &> &>>
+static int bare_redir(const char *w, size_t len, size_t lit) {
+    size_t i = 0;
+    if (len == 0 || len > lit) return 0;
+    if (w[0] == '&') {
+        i = 1;
+        if (i == len || w[i] != '>') return 0;
+    } else {
+        while (i < len && w[i] >= '0' && w[i] <= '9') i++;
+        if (i == len || (w[i] != '<' && w[i] != '>')) return 0;
+    }
+    char op = w[i++];
+    if (i < len && (w[i] == op || w[i] == '&' || (op == '>' && w[i] == '|'))) i++;
+    if (i < len && op == '<' && w[i - 1] == '<' && w[i] == '<') i++;
+    return i == len;
+}
+
+/* Expand the words from..to-1 into lt->fields. Returns the index of the
+ * first field they gave, or -1. The shell expands each pipeline's words
+ * just before running it, so `cd /tmp && echo $PWD` sees the new
+ * directory; a word without expansions is used where it lies. Unquoted
+ * values are split on blanks and patterns become the names they match,
+ * except in a redirection's target. */
+long expand_words(linetok *lt, size_t from, size_t to) {
+    long first = (long)lt->nfields;
+    int target = 0;                 // the word is a redirection's target
+    for (size_t i = from; i < to && i < lt->size; i++) {
+        const span *sp = &lt->spans[i];
+        if (sp->op != TOK_WORD) continue;
+        int split = !target;
+        target = bare_redir(lt->arena + sp->off, sp->len, sp->lit);
+        if (sp->nexp > 0 || (sp->glob && split)) {
+            if (expand_word(lt, sp, split) != 0) return -1;
+            continue;
+        }
+        span *f = push_field(lt);
+        if (!f) return -1;
+        *f = *sp;
+    }
+    return first;
+}
+
+/* NULL-terminated argv-style view of the fields, valid until the next
+ * tokenize_line() or expand_words() on lt.
+ */
+char **line_fields(linetok *lt) {
+    for (size_t i = 0; i < lt->nfields; i++) {
+        lt->field_items[i] = lt->arena + lt->fields[i].off;
+    }
+    if (lt->field_items) lt->field_items[lt->nfields] = NULL;
+    return lt->field_items;
+}
+
+void free_linetok(linetok *lt) {
+    if (!lt) return;
+    free(lt->arena);
+    free(lt->spans);
+    free(lt->exps);
+    free(lt->qmeta);
+    free(lt->fields);
+    free(lt->field_items);
+    memset(lt, 0, sizeof(*lt));
 }
 
 #ifdef LEXER_TEST
-/* Simple interactive test harness for the lexer.
- * Build with: gcc -DLEXER_TEST -o bin/lexer_test src/lexer.c
+/* Test harness for the lexer: fixed cases first, then an interactive loop
+ * that prints the fields of each line typed.
+ * Build with: gcc -DLEXER_TEST -Iinclude -o bin/lexer_test src/lexer.c src/prompt.c src/pathglob.c
  */
+static int check(const char *line, const char *want) {
+    linetok lt = {0};
+    char got[256] = "";
+    if (tokenize_line(&lt, line, strlen(line)) >= 0 && expand_words(&lt, 0, lt.size) >= 0) {
+        char **words = line_fields(&lt);
+        for (size_t i = 0; i < lt.nfields; i++) {
+            if (i) strncat(got, "|", sizeof(got) - strlen(got) - 1);
+            strncat(got, words[i], sizeof(got) - strlen(got) - 1);
+        }
+    }
+    free_linetok(&lt);
+    if (strcmp(got, want) == 0) return 0;
+    printf("FAIL: %s\n  want (%s)\n  got  (%s)\n", line, want, got);
+    return 1;
+}
+
 int main(void) {
+    // fields joined with |
+    static const struct { const char *line, *want; } cases[] = {
+        { "echo hi # trailing",      "echo|hi" },
+        { "# a whole comment line",  "" },
+        { "#!/bin/sh",               "" },
+        { "echo a#b '#' \\# \"#\"",   "echo|a#b|#|#|#" },
+        { "echo x;# after ;",        "echo|x" },
+        { "echo 'q # not' done",     "echo|q # not|done" },
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) failed += check(cases[i].line, cases[i].want);
+    printf(failed ? "%d failed\n" : "all passed\n", failed);
+
     while (1) {
-        printf("%s>",get_prompt());
-        fflush(stdout);
+        print_prompt();
 
-        char *input = get_input();
-        if (!input) break;        /* allocation failure */
-        if (input[0] == '\0' && feof(stdin)) { /* EOF */
-            free(input);
-            break;
-        }
+        size_t len;
+        char *input = read_line(&len);
+        if (!input) break;        /* EOF */
 
         printf("whole input: %s\n", input);
 
-        tokenlist *tokens = get_tokens(input);
-        for (int i = 0; i < (int)tokens->size; i++) {
-            printf("token %d: (%s)\n", i, tokens->items[i]);
+        linetok lt = {0};
+        tokenize_line(&lt, input, len);
+        expand_words(&lt, 0, lt.size);
+        char **words = line_fields(&lt);
+        for (int i = 0; i < (int)lt.nfields; i++) {
+            printf("token %d: (%s)\n", i, words[i]);
         }
 
-        free(input);
-        free_tokens(tokens);
+        free_linetok(&lt);
     }
     return 0;
 }
 #endif
+
+#ifdef LEXER_BENCH
+/* Line-reader throughput (the old 4-byte fgets/realloc loop vs read_line())
+ * and tokenizer cost (strtok + strdup per word vs linetok).
+ * Build with: gcc -O2 -DLEXER_BENCH -Iinclude -o bin/lexer_bench src/lexer.c src/prompt.c src/pathglob.c
+ * Usage: bin/lexer_bench [scratch-file]
+ */
+#include <fcntl.h>
+#include <time.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The malloc-per-line fgets() reader that read_line() replaced, reading from f. */
+static char *old_get_input(FILE *f) {
+    char *buffer = NULL;
+    int bufsize = 0;
+    char line[5];
+    while (fgets(line, (int)sizeof(line), f) != NULL) {
+        char *newln = strchr(line, '\n');
+        int addby = newln ? (int)(newln - line) : (int)sizeof(line) - 1;
+        char *tmp = (char *)realloc(buffer, (size_t)bufsize + (size_t)addby);
+        if (!tmp) break;
+        buffer = tmp;
+        memcpy(&buffer[bufsize], line, (size_t)addby);
+        bufsize += addby;
+        if (newln != NULL) break;
+    }
+    if (buffer == NULL) return NULL;
+    char *tmp = (char *)realloc(buffer, (size_t)bufsize + 1u);
+    if (!tmp) {
+        free(buffer);
+        return NULL;
+    }
+    tmp[bufsize] = '\0';
+    return tmp;
+}
+
+static void write_workload(const char *path, int nlines, int width) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    for (int i = 0; i < nlines; i++) {
+        for (int j = 0; j < width; j++) fputc('a' + (i + j) % 26, f);
+        fputc('\n', f);
+    }
+    fclose(f);
+}
+
+static void bench(const char *path, const char *label, int nlines, int width) {
+    write_workload(path, nlines, width);
+    double mb = (double)nlines * (width + 1) / (1 << 20);
+
+    FILE *f = fopen(path, "r");
+    size_t got = 0;
+    double t0 = now_sec();
+    char *l;
+    while ((l = old_get_input(f)) != NULL) {
+        got += strlen(l);
+        free(l);
+    }
+    double t_old = now_sec() - t0;
+    fclose(f);
+
+    int fd = open(path, O_RDONLY);
+    reader_init(fd);
+    size_t len, got2 = 0;
+    t0 = now_sec();
+    while (read_line(&len) != NULL) got2 += len;
+    double t_new = now_sec() - t0;
+    close(fd);
+
+    if (got != got2) fprintf(stderr, "mismatch: %zu vs %zu bytes\n", got, got2);
+    printf("%-28s old %8.1f MB/s   read_line %8.1f MB/s   (%.1fx)\n",
+           label, mb / t_old, mb / t_new, t_old / t_new);
+}
+
+/* The strtok tokenize() + strdup-per-word expansion this tokenizer replaced,
+ * counting its allocations.
+ */
+static size_t old_allocs;
+
+static char *old_expand(const char *tok) {
+    old_allocs++;
+    if (tok[0] == '~' && (tok[1] == '\0' || tok[1] == '/')) {
+        const char *home = getenv("HOME");
+        if (!home) home = "";
+        size_t hl = strlen(home), tl = strlen(tok);
+        char *out = (char *)malloc(hl + tl);
+        memcpy(out, home, hl);
+        memcpy(out + hl, tok + 1, tl);
+        return out;
+    }
+    if (tok[0] == '$' && tok[1] != '\0') {
+        for (int i = 1; tok[i]; i++) {
+            if (!is_var_name_char(tok[i])) return strdup(tok);
+        }
+        const char *val = getenv(tok + 1);
+        return strdup(val ? val : "");
+    }
+    return strdup(tok);
+}
+
+static int old_tokenize(const char *input, char **toks, int max) {
+    char *buf = strdup(input);
+    old_allocs++;
+    int count = 0;
+    for (char *t = strtok(buf, " \t\r\n"); t && count < max; t = strtok(NULL, " \t\r\n")) {
+        toks[count++] = strdup(t);
+        old_allocs++;
+    }
+    free(buf);
+    return count;
+}
+
+static void bench_tokenizer(void) {
+    static const char *lines[] = {
+        "ls -la /usr/share/doc | grep -v README | sort | uniq -c > /tmp/out.txt",
+        "cd ~/projects/shell && make clean all",
+        "echo $HOME $USER $PATH ~ ~/bin plain words only here",
+    };
+    const int iters = 300000;
+    double t0 = now_sec();
+    for (int n = 0; n < iters; n++) {
+        char *raw[256], *toks[256];
+        int c = old_tokenize(lines[n % 3], raw, 256);
+        for (int i = 0; i < c; i++) toks[i] = old_expand(raw[i]);
+        for (int i = 0; i < c; i++) {
+            free(raw[i]);
+            free(toks[i]);
+        }
+    }
+    double t_old = now_sec() - t0;
+
+    linetok lt = {0};
+    size_t new_allocs = 0;
+    t0 = now_sec();
+    for (int n = 0; n < iters; n++) {
+        size_t cap = lt.cap, scap = lt.span_cap, fcap = lt.field_cap;
+        tokenize_line(&lt, lines[n % 3], strlen(lines[n % 3]));
+        expand_words(&lt, 0, lt.size);
+        line_fields(&lt);
+        new_allocs += (lt.cap != cap) + (lt.span_cap != scap) + 2 * (lt.field_cap != fcap);
+    }
+    double t_new = now_sec() - t0;
+    free_linetok(&lt);
+
+    printf("tokenize+expand              old %6.0f ns/line %5.2f allocs/line   "
+           "linetok %6.0f ns/line %5.2f allocs/line\n",
+           t_old * 1e9 / iters, (double)old_allocs / iters,
+           t_new * 1e9 / iters, (double)new_allocs / iters);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "/tmp/lexer_bench.txt";
+    bench(path, "long lines (20k x 2 KB)", 20000, 2048);
+    bench(path, "script (500k x 40 B)", 500000, 40);
+    unlink(path);
+    bench_tokenizer();
+    return 0;
+}
+#endif
@@ -0,0 +1,627 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE             // TIOCGWINSZ, DT_* for completion
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include "history.h"
+#include "lexer.h"
+#include "lineedit.h"
+#include "path_search.h"
+
+/* Interactive line editor. The terminal is in raw mode only while a line
+ * is being read, and every wait for a key goes through the reader's wait
+ * hook, so SIGCHLD notices still arrive while the user is typing; the
+ * shell calls lineedit_hide()/lineedit_show() around them.
+ *
+ * The line is shown on a single row that scrolls horizontally. Each
+ * redraw is built in one buffer and written with one write().
+ *   ^A ^E ^B ^F, Home End Left Right   move
+ *   ^H/Backspace ^D/Delete ^K ^U ^W    delete
+ *   Up Down, ^P ^N                     history
+ *   ^R                                 incremental reverse search
+ *   Tab                                complete; twice lists the choices
+ *   ^L clear screen   ^C discard line  ^D on an empty line: end of input
+ */
+
+#define ESC_TIMEOUT_MS  50          // wait for the rest of an escape sequence
+#define LIST_MAX        200         // ask no questions, just cap the listing
+
+enum {
+    KEY_EOF = -1, KEY_NONE = -2,
+    KEY_UP = 0x100, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_HOME, KEY_END, KEY_DEL,
+};
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+
+static struct {
+    char       *buf;
+    size_t      len, pos, cap;
+    const char *prompt;     // whole prompt, written once per line
+    const char *pline;      // its last line, redrawn on every refresh
+    size_t      pwidth;
+    unsigned    hist;       // history entry shown, 0 = the line being typed
+    char       *saved;      // the line being typed, while browsing history
+    size_t      saved_len, saved_cap;
+    int         active;     // raw mode is on and the line is on screen
+    struct termios cooked;
+} ed;
+
+static unsigned char inbuf[256];
+static size_t in_pos, in_len;
+
+static char  *out;
+static size_t out_len, out_cap;
+
+static const char *const *builtins;
+
+int lineedit_usable(void) {
+    const char *term = getenv("TERM");
+    return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) &&
+           term && *term && strcmp(term, "dumb") != 0;
+}
+
+void lineedit_set_builtins(const char *const *names) {
+    builtins = names;
+}
+
+static int reserve(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) return 0;
+    size_t n = *cap ? *cap : 128;
+    while (n < need) n *= 2;
+    char *tmp = realloc(*buf, n);
+    if (!tmp) return -1;
+    *buf = tmp;
+    *cap = n;
+    return 0;
+}
+
+static void emit(const char *s, size_t n) {
+    if (reserve(&out, &out_cap, out_len + n) != 0) return;
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+static void emits(const char *s) {
+    emit(s, strlen(s));
+}
+
+static void flush_out(void) {
+    size_t off = 0;
+    while (off < out_len) {
+        ssize_t n = write(STDOUT_FILENO, out + off, out_len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += (size_t)n;
+    }
+    out_len = 0;
+}
+
+static int raw_on(void) {
+    if (tcgetattr(STDIN_FILENO, &ed.cooked) != 0) return -1;
+    struct termios raw = ed.cooked;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);     // OPOST stays: "\n" still returns
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+}
+
+static void raw_off(void) {
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &ed.cooked);
+}
+
+// next input byte; with wait_ms >= 0, KEY_NONE if none arrives in time
+static int read_byte(int wait_ms) {
+    while (in_pos == in_len) {
+        if (wait_ms >= 0) {
+            struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+            int rc = poll(&pfd, 1, wait_ms);
+            if (rc < 0 && errno == EINTR) continue;
+            if (rc <= 0) return KEY_NONE;
+        } else if (reader_wait_readable(STDIN_FILENO) != 0) {
+            return KEY_EOF;
+        }
+        ssize_t n = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (n <= 0) return KEY_EOF;
+        in_pos = 0;
+        in_len = (size_t)n;
+    }
+    return inbuf[in_pos++];
+}
+
+// one key; CSI and SS3 sequences for the keys we know, others swallowed
+static int read_key(void) {
+    int c = read_byte(-1);
+    if (c != 0x1b) return c;
+    int c1 = read_byte(ESC_TIMEOUT_MS);
+    if (c1 == 'O') {
+        switch (read_byte(ESC_TIMEOUT_MS)) {
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        default:  return KEY_NONE;
+        }
+    }
+    if (c1 != '[') return KEY_NONE;
+    int num = 0, c2;
+    while (((c2 = read_byte(ESC_TIMEOUT_MS)) >= '0' && c2 <= '9') || c2 == ';') {
+        if (c2 != ';') num = num * 10 + (c2 - '0');
+    }
+    switch (c2) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case '~':
+        if (num == 1 || num == 7) return KEY_HOME;
+        if (num == 4 || num == 8) return KEY_END;
+        if (num == 3) return KEY_DEL;
+        return KEY_NONE;
+    default:
+        return KEY_NONE;
+    }
+}
+
+static size_t term_cols(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+    return 80;
+}
+
+// columns taken by s: escape sequences and UTF-8 continuation bytes are free
+static size_t display_width(const char *s) {
+    size_t w = 0;
+    while (*s) {
+        unsigned char c = (unsigned char)*s++;
+        if (c == 0x1b) {
+            if (*s == '[') {
+                s++;
+                while (*s && !(*s >= 0x40 && *s <= 0x7e)) s++;
+                if (*s) s++;
+            } else if (*s) {
+                s++;
+            }
+            continue;
+        }
+        if (c < 0x20 || (c & 0xc0) == 0x80) continue;
+        w++;
+    }
+    return w;
+}
+
+// redraw the prompt's last line and the part of the buffer that fits
+static void refresh(void) {
+    size_t cols = term_cols();
+    size_t avail = cols > ed.pwidth + 1 ? cols - ed.pwidth - 1 : 1;
+    size_t from = ed.pos > avail ? ed.pos - avail : 0;
+    size_t show = ed.len - from < avail ? ed.len - from : avail;
+
+    emit("\r", 1);
+    emits(ed.pline);
+    emit(ed.buf + from, show);
+    emits("\x1b[K\r");
+    size_t col = ed.pwidth + (ed.pos - from);
+    if (col > 0) {
+        char mv[32];
+        int n = snprintf(mv, sizeof(mv), "\x1b[%zuC", col);
+        emit(mv, (size_t)n);
+    }
+    flush_out();
+}
+
+static int set_line(const char *s, size_t n) {
+    if (reserve(&ed.buf, &ed.cap, n + 1) != 0) return -1;
+    memmove(ed.buf, s, n);
+    ed.len = ed.pos = n;
+    return 0;
+}
+
+static int insert(const char *s, size_t n) {
+    if (reserve(&ed.buf, &ed.cap, ed.len + n + 1) != 0) return -1;
+    memmove(ed.buf + ed.pos + n, ed.buf + ed.pos, ed.len - ed.pos);
+    memcpy(ed.buf + ed.pos, s, n);
+    ed.len += n;
+    ed.pos += n;
+    return 0;
+}
+
+// remove [from, to) of the line
+static void cut(size_t from, size_t to) {
+    memmove(ed.buf + from, ed.buf + to, ed.len - to);
+    ed.len -= to - from;
+    if (ed.pos >= to) ed.pos -= to - from;
+    else if (ed.pos > from) ed.pos = from;
+}
+
+// Up/Down: step to entry n (0 = the line being typed), keeping that line
+static void history_step(int older) {
+    unsigned first = history_first(), last = history_last();
+    if (last == 0) return;
+    unsigned n;
+    if (older) {
+        if (ed.hist == 0) n = last;
+        else if (ed.hist > first) n = ed.hist - 1;
+        else return;
+    } else {
+        if (ed.hist == 0) return;
+        n = ed.hist < last ? ed.hist + 1 : 0;
+    }
+    if (ed.hist == 0) {
+        if (reserve(&ed.saved, &ed.saved_cap, ed.len + 1) != 0) return;
+        memcpy(ed.saved, ed.buf, ed.len);
+        ed.saved_len = ed.len;
+    }
+    if (n == 0) {
+        set_line(ed.saved, ed.saved_len);
+    } else {
+        size_t len;
+        const char *s = history_get(n, &len);
+        if (!s) return;
+        set_line(s, len);
+    }
+    ed.hist = n;
+}
+
+/* Ctrl-R: the search state lives in history.c; this only draws it.
+ * Returns the key that ended the search, for the caller to process
+ * against the recalled line ('\r' when the match was accepted). */
+static int reverse_search(void) {
+    isearch s;
+    isearch_begin(&s);
+    char *orig = malloc(ed.len + 1);
+    size_t orig_len = ed.len, orig_pos = ed.pos;
+    if (orig) memcpy(orig, ed.buf, ed.len);
+
+    for (;;) {
+        size_t mlen = 0;
+        const char *m = s.match ? history_get(s.match, &mlen) : NULL;
+        emits(s.failing ? "\r(failed reverse-i-search)`" : "\r(reverse-i-search)`");
+        emit(s.query, s.len);
+        emits("': ");
+        size_t room = term_cols() - 1;
+        size_t used = (s.failing ? 27 : 20) + s.len + 3;
+        if (m && used < room) emit(m, mlen < room - used ? mlen : room - used);
+        emits("\x1b[K");
+        flush_out();
+
+        int c = read_key();
+        int r = c == KEY_EOF ? ISEARCH_ABORT : c < 0 || c >= 0x100 ? ISEARCH_PASS : isearch_key(&s, c);
+        if (r == ISEARCH_MORE) continue;
+        if (r == ISEARCH_ABORT) {
+            if (orig) set_line(orig, orig_len);
+            ed.pos = orig_pos < ed.len ? orig_pos : ed.len;
+            free(orig);
+            return c == KEY_EOF ? KEY_EOF : KEY_NONE;
+        }
+        free(orig);
+        if (s.match) {
+            m = history_get(s.match, &mlen);
+            if (m) set_line(m, mlen);
+            ed.hist = 0;
+        }
+        return r == ISEARCH_ACCEPT ? '\r' : c;
+    }
+}
+
+/* ---- completion ---- */
+
+typedef struct {
+    char  **v;
+    size_t  n, cap;
+} candlist;
+
+static int cand_add(candlist *cl, const char *s, size_t n, int dir) {
+    if (cl->n == cl->cap) {
+        size_t cap = cl->cap ? cl->cap * 2 : 32;
+        char **tmp = realloc(cl->v, cap * sizeof(*tmp));
+        if (!tmp) return -1;
+        cl->v = tmp;
+        cl->cap = cap;
+    }
+    char *c = malloc(n + 2);
+    if (!c) return -1;
+    memcpy(c, s, n);
+    if (dir) c[n++] = '/';
+    c[n] = '\0';
+    cl->v[cl->n++] = c;
+    return 0;
+}
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void cand_sort(candlist *cl) {
+    qsort(cl->v, cl->n, sizeof(*cl->v), cmp_str);
+    size_t k = 0;
+    for (size_t i = 0; i < cl->n; i++) {
+        if (k > 0 && strcmp(cl->v[k - 1], cl->v[i]) == 0) free(cl->v[i]);
+        else cl->v[k++] = cl->v[i];
+    }
+    cl->n = k;
+}
+
+static void cand_free(candlist *cl) {
+    for (size_t i = 0; i < cl->n; i++) free(cl->v[i]);
+    free(cl->v);
+}
+
+static void complete_command(candlist *cl, const char *word, size_t len) {
+    for (size_t i = 0; builtins && builtins[i]; i++) {
+        if (strncmp(builtins[i], word, len) == 0) cand_add(cl, builtins[i], strlen(builtins[i]), 0);
+    }
+    char **found;
+    size_t n = path_complete(word, len, &found);
+    for (size_t i = 0; i < n; i++) cand_add(cl, found[i], strlen(found[i]), 0);
+}
+
+// entries of the word's directory matching its last component
+static void complete_file(candlist *cl, const char *word, size_t len, size_t base) {
+    char dir[4096];
+    size_t dlen = base;
+    if (dlen == 0) {
+        strcpy(dir, ".");
+    } else {
+        const char *home = getenv("HOME");
+        size_t skip = 0, hlen = 0;
+        if (word[0] == '~' && (dlen == 1 || word[1] == '/') && home) {
+            skip = 1;
+            hlen = strlen(home);
+        }
+        if (hlen + dlen - skip >= sizeof(dir)) return;
+        memcpy(dir, home, hlen);
+        memcpy(dir + hlen, word + skip, dlen - skip);
+        dir[hlen + dlen - skip] = '\0';
+    }
+    const char *prefix = word + base;
+    size_t plen = len - base;
+
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (plen == 0 || prefix[0] != '.')) continue;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (strncmp(name, prefix, plen) != 0) continue;
+        int is_dir = de->d_type == DT_DIR;
+        if (de->d_type == DT_UNKNOWN || de->d_type == DT_LNK) {
+            struct stat st;
+            is_dir = fstatat(dirfd(d), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        cand_add(cl, name, strlen(name), is_dir);
+    }
+    closedir(d);
+}
+
+static void list_candidates(const candlist *cl) {
+    size_t width = 0;
+    for (size_t i = 0; i < cl->n && i < LIST_MAX; i++) {
+        size_t w = strlen(cl->v[i]);
+        if (w > width) width = w;
+    }
+    width += 2;
+    size_t shown = cl->n < LIST_MAX ? cl->n : LIST_MAX;
+    size_t ncols = term_cols() / width;
+    if (ncols == 0) ncols = 1;
+    size_t rows = (shown + ncols - 1) / ncols;
+
+    emits("\n");
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t c = 0; c < ncols; c++) {
+            size_t i = c * rows + r;
+            if (i >= shown) break;
+            size_t w = strlen(cl->v[i]);
+            emit(cl->v[i], w);
+            if (c + 1 < ncols && (c + 1) * rows + r < shown) {
+                for (; w < width; w++) emit(" ", 1);
+            }
+        }
+        emits("\n");
+    }
+    if (shown < cl->n) {
+        char more[64];
+        int n = snprintf(more, sizeof(more), "... and %zu more\n", cl->n - shown);
+        emit(more, (size_t)n);
+    }
+    emits(ed.prompt);
+    flush_out();
+}
+
+/* Complete the word before the cursor: a command name in command position,
+ * otherwise a file path. One match is inserted whole; several insert their
+ * common prefix, and a second Tab in a row lists them. */
+static void complete(int listing) {
+    size_t start = ed.pos;
+    while (start > 0 && !strchr(" \t|&;<>()", ed.buf[start - 1])) start--;
+    size_t k = start;
+    while (k > 0 && (ed.buf[k - 1] == ' ' || ed.buf[k - 1] == '\t')) k--;
+    int cmd_pos = k == 0 || strchr("|&;(", ed.buf[k - 1]) != NULL;
+
+    const char *word = ed.buf + start;
+    size_t len = ed.pos - start;
+    size_t base = len;
+    while (base > 0 && word[base - 1] != '/') base--;
+
+    candlist cl = {0};
+    if (cmd_pos && base == 0 && !(len > 0 && word[0] == '~')) complete_command(&cl, word, len);
+    else complete_file(&cl, word, len, base);
+    cand_sort(&cl);
+
+    size_t have = len - base;
+    if (cl.n == 0) {
+        emits("\a");
+        flush_out();
+    } else if (cl.n == 1) {
+        const char *c = cl.v[0];
+        size_t clen = strlen(c);
+        insert(c + have, clen - have);
+        if (c[clen - 1] != '/' && (ed.pos == ed.len || ed.buf[ed.pos] != ' ')) insert(" ", 1);
+    } else {
+        size_t common = strlen(cl.v[0]);
+        for (size_t i = 1; i < cl.n; i++) {
+            size_t j = 0;
+            while (j < common && cl.v[i][j] == cl.v[0][j]) j++;
+            common = j;
+        }
+        if (common > have) insert(cl.v[0] + have, common - have);
+        else if (listing) list_candidates(&cl);
+        else {
+            emits("\a");
+            flush_out();
+        }
+    }
+    cand_free(&cl);
+}
+
+/* ---- entry points ---- */
+
+void lineedit_hide(void) {
+    if (!ed.active) return;
+    emits("\r\x1b[K");
+    flush_out();
+}
+
+int lineedit_show(void) {
+    if (!ed.active) return 0;
+    emits(ed.prompt);
+    refresh();
+    return 1;
+}
+
+static char *finish(size_t *len) {
+    ed.active = 0;
+    raw_off();
+    ed.buf[ed.len] = '\0';
+    *len = ed.len;
+    return ed.buf;
+}
+
+/* Read one line with editing. Returns the NUL-terminated line (valid until
+ * the next call) or NULL at end of input. */
+char *lineedit_read(const char *prompt, size_t *len) {
+    fflush(stdout);
+    if (reserve(&ed.buf, &ed.cap, 128) != 0 || raw_on() != 0) {
+        fputs(prompt, stdout);
+        fflush(stdout);
+        return read_line(len);
+    }
+    const char *nl = strrchr(prompt, '\n');
+    ed.prompt = prompt;
+    ed.pline = nl ? nl + 1 : prompt;
+    ed.pwidth = display_width(ed.pline);
+    ed.len = ed.pos = 0;
+    ed.hist = 0;
+    ed.active = 1;
+    emits(prompt);
+    flush_out();
+
+    int tabs = 0;
+    for (;;) {
+        int c = read_key();
+        if (c == KEY_CTRL('R')) c = reverse_search();
+        if (c == '\t') {
+            complete(tabs++ > 0);
+            refresh();
+            continue;
+        }
+        tabs = 0;
+
+        switch (c) {
+        case KEY_EOF:
+            emits("\n");
+            flush_out();
+            finish(len);
+            return NULL;
+        case '\r':
+        case '\n':
+            ed.pos = ed.len;
+            refresh();
+            emits("\n");
+            flush_out();
+            return finish(len);
+        case KEY_CTRL('D'):
+            if (ed.len == 0) {
+                emits("\n");
+                flush_out();
+                finish(len);
+                return NULL;
+            }
+            /* fall through */
+        case KEY_DEL:
+            if (ed.pos < ed.len) cut(ed.pos, ed.pos + 1);
+            break;
+        case KEY_CTRL('C'):
+            ed.pos = ed.len;
+            refresh();
+            emits("^C\n");
+            emits(prompt);
+            ed.len = ed.pos = 0;
+            ed.hist = 0;
+            break;
+        case 0x7f:
+        case KEY_CTRL('H'):
+            if (ed.pos > 0) cut(ed.pos - 1, ed.pos);
+            break;
+        case KEY_CTRL('A'):
+        case KEY_HOME:
+            ed.pos = 0;
+            break;
+        case KEY_CTRL('E'):
+        case KEY_END:
+            ed.pos = ed.len;
+            break;
+        case KEY_CTRL('B'):
+        case KEY_LEFT:
+            if (ed.pos > 0) ed.pos--;
+            break;
+        case KEY_CTRL('F'):
+        case KEY_RIGHT:
+            if (ed.pos < ed.len) ed.pos++;
+            break;
+        case KEY_CTRL('K'):
+            ed.len = ed.pos;
+            break;
+        case KEY_CTRL('U'):
+            cut(0, ed.pos);
+            break;
+        case KEY_CTRL('W'): {
+            size_t from = ed.pos;
+            while (from > 0 && ed.buf[from - 1] == ' ') from--;
+            while (from > 0 && ed.buf[from - 1] != ' ') from--;
+            cut(from, ed.pos);
+            break;
+        }
+        case KEY_CTRL('L'):
+            emits("\x1b[H\x1b[2J");
+            emits(prompt);
+            break;
+        case KEY_CTRL('P'):
+        case KEY_UP:
+            history_step(1);
+            break;
+        case KEY_CTRL('N'):
+        case KEY_DOWN:
+            history_step(0);
+            break;
+        default:
+            if (c >= 0x20 && c < 0x100 && c != 0x7f) {
+                char ch = (char)c;
+                insert(&ch, 1);
+            }
+            break;
+        }
+        refresh();
+    }
+}
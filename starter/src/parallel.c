@@ -0,0 +1,352 @@
+#define _GNU_SOURCE                 // pipe2
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "launch.h"
+#include "parallel.h"
+#include "path_search.h"
+
+/* parallel [-j N] command [args] [::: arg...]
+ *
+ * Runs command once per argument, at most N at a time (default: one per
+ * online CPU). `{}` in a word is replaced by the argument, otherwise the
+ * argument is appended. Without `:::` the arguments are the lines of stdin.
+ *
+ * A new job starts as soon as one exits: the shell's SIGCHLD self-pipe is
+ * polled along with the jobs' output pipes, so the runner sleeps until
+ * a child exits or has output. Each job's stdout and stderr go to pipes of
+ * their own, or to one pipe when the shell's stdout and stderr are the
+ * same file (a terminal, or 2>&1): two pipes can't say which write came
+ * first, so a job's stderr would otherwise lose its place among its
+ * stdout lines. Output comes out in argument order and never interleaved:
+ * the oldest unfinished job streams straight through, later ones are held
+ * in memory until it is their turn. Jobs read /dev/null.
+ *
+ * Exit status is the number of failed jobs, capped at 101 as in GNU
+ * parallel; 127 when the command is not found.
+ */
+
+typedef struct {
+    char  *data;
+    size_t len, cap;
+} pbuf;
+
+typedef struct {
+    const char *arg;
+    pid_t pid;          // 0 = not started, -1 = reaped
+    int   fd[2];        // read ends for its stdout and stderr, -1 at EOF
+    int   status;
+    pbuf  held[2];      // output waiting for its turn
+} pjob;
+
+static int (*wakeup_fd)(void);
+
+void parallel_set_wakeup(int (*fn)(void)) {
+    wakeup_fd = fn;
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static int hold(pbuf *b, const char *p, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + n) cap *= 2;
+        char *nd = realloc(b->data, cap);
+        if (!nd) return -1;
+        b->data = nd;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+    return 0;
+}
+
+// word with every {} replaced by arg
+static char *substitute(const char *word, const char *arg) {
+    size_t alen = strlen(arg), n = 0;
+    for (const char *s = word; (s = strstr(s, "{}")) != NULL; s += 2) n++;
+    char *out = malloc(strlen(word) + n * alen + 1);
+    if (!out) return NULL;
+    char *o = out;
+    for (const char *s = word; *s; ) {
+        if (s[0] == '{' && s[1] == '}') {
+            memcpy(o, arg, alen);
+            o += alen;
+            s += 2;
+        } else {
+            *o++ = *s++;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+
+typedef struct {
+    char **cmd;         // command words, {} not yet replaced
+    int    ncmd;
+    int    replace;     // some word has {}
+    char  *path;        // resolved once unless the command word has {}
+    int    devnull;
+    int    combined;    // stdout and stderr are one file: one pipe per job
+} prun;
+
+static int same_file(int a, int b) {
+    struct stat sa, sb;
+    return fstat(a, &sa) == 0 && fstat(b, &sb) == 0
+        && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+// start job j; on failure it is marked finished with status 127
+static int start(prun *r, pjob *j) {
+    char **argv = calloc((size_t)r->ncmd + 2, sizeof(*argv));
+    int n = 0, rc = -1;
+    int out[2] = {-1, -1}, err[2] = {-1, -1};
+    char *path = r->path;
+    if (!argv) goto fail;
+    for (int i = 0; i < r->ncmd; i++) {
+        argv[n++] = r->replace ? substitute(r->cmd[i], j->arg) : r->cmd[i];
+        if (!argv[n - 1]) goto fail;
+    }
+    if (!r->replace) argv[n++] = (char *)j->arg;
+    if (!path && !(path = search_path(argv[0]))) {
+        fprintf(stderr, "command not found: %s\n", argv[0]);
+        goto fail;
+    }
+    if (pipe2(out, O_CLOEXEC) != 0 || (!r->combined && pipe2(err, O_CLOEXEC) != 0)) {
+        perror("pipe");
+        goto fail;
+    }
+    launch_spec ls;
+    launch_spec_init(&ls);
+    launch_dup2(&ls, r->devnull, STDIN_FILENO);
+    launch_dup2(&ls, out[1], STDOUT_FILENO);
+    launch_dup2(&ls, r->combined ? out[1] : err[1], STDERR_FILENO);
+    j->pid = launch_process(path, argv, &ls);
+    launch_spec_free(&ls);
+    if (j->pid > 0) {
+        j->fd[0] = out[0];
+        j->fd[1] = err[0];
+        out[0] = err[0] = -1;
+        rc = 0;
+    }
+
+fail:
+    for (int k = 0; k < 2; k++) {
+        if (out[k] >= 0) close(out[k]);
+        if (err[k] >= 0) close(err[k]);
+    }
+    if (path != r->path) free(path);
+    if (argv && r->replace) {
+        for (int i = 0; i < r->ncmd; i++) free(argv[i]);
+    }
+    free(argv);
+    if (rc != 0) {
+        j->pid = -1;
+        j->status = 127 << 8;
+    }
+    return rc;
+}
+
+static int finished(const pjob *j) {
+    return j->pid == -1 && j->fd[0] < 0 && j->fd[1] < 0;
+}
+
+// the job's turn: what it held so far goes out, the rest streams through
+static void release(pjob *j) {
+    for (int k = 0; k < 2; k++) {
+        if (j->held[k].len) write_all(k + 1, j->held[k].data, j->held[k].len);
+        free(j->held[k].data);
+        j->held[k] = (pbuf){ NULL, 0, 0 };
+    }
+}
+
+static char **read_lines(int *count) {
+    char **lines = NULL;
+    int n = 0, cap = 0;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, stdin)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            char **nl = realloc(lines, (size_t)cap * sizeof(*nl));
+            if (!nl) break;
+            lines = nl;
+        }
+        if (!(lines[n] = strdup(line))) break;
+        n++;
+    }
+    free(line);
+    *count = n;
+    return lines;
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: parallel [-j N] command [args] [::: arg...]\n");
+    return 2;
+}
+
+int builtin_parallel(int argc, char **argv) {
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    int a = 1;
+    for (; a < argc && argv[a][0] == '-' && argv[a][1] == 'j'; a++) {
+        const char *v = argv[a][2] ? argv[a] + 2 : a + 1 < argc ? argv[++a] : "";
+        char *end;
+        slots = strtol(v, &end, 10);
+        if (!*v || *end || slots < 1) return usage();
+    }
+    if (slots < 1) slots = 1;
+
+    int sep = a;
+    while (sep < argc && strcmp(argv[sep], ":::") != 0) sep++;
+    if (sep == a) return usage();
+
+    char **args;
+    int nargs;
+    char **lines = NULL;
+    if (sep < argc) {
+        args = argv + sep + 1;
+        nargs = argc - sep - 1;
+    } else {
+        lines = args = read_lines(&nargs);
+    }
+
+    prun r = { argv + a, sep - a, 0, NULL, -1, same_file(STDOUT_FILENO, STDERR_FILENO) };
+    for (int i = 0; i < r.ncmd; i++) {
+        if (strstr(r.cmd[i], "{}")) r.replace = 1;
+    }
+    int rc = 0;
+    pjob *jobs = calloc((size_t)nargs + 1, sizeof(*jobs));
+    struct pollfd *pfd = NULL;
+    pjob **polled = NULL;
+    size_t pcap = 0;
+    if (!jobs) {
+        perror("calloc");
+        rc = 1;
+        goto out;
+    }
+    for (int i = 0; i < nargs; i++) {
+        jobs[i].arg = args[i];
+        jobs[i].fd[0] = jobs[i].fd[1] = -1;
+    }
+    if (!strstr(r.cmd[0], "{}") && !(r.path = search_path(r.cmd[0]))) {
+        fprintf(stderr, "command not found: %s\n", r.cmd[0]);
+        rc = 127;
+        goto out;
+    }
+    if ((r.devnull = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0) {
+        perror("parallel");
+        rc = 1;
+        goto out;
+    }
+    // without a SIGCHLD pipe, exits are noticed by polling every 10 ms
+    int wake = wakeup_fd ? wakeup_fd() : -1;
+    fflush(stdout);
+
+    // head: oldest job whose output has not all gone out; next: first not started
+    int head = 0, next = 0, running = 0, failed = 0;
+    while (head < nargs) {
+        while (running < slots && next < nargs) {
+            if (start(&r, &jobs[next++]) == 0) running++;
+        }
+
+        // exited jobs can still have pipes open (a background grandchild)
+        size_t want = (size_t)(next - head) * 2 + 1;
+        if (want > pcap) {
+            struct pollfd *grown = realloc(pfd, want * sizeof(*pfd));
+            if (grown) pfd = grown;
+            pjob **grown_jobs = realloc(polled, want * sizeof(*polled));
+            if (grown_jobs) polled = grown_jobs;
+            if (!grown || !grown_jobs) {
+                perror("realloc");
+                break;
+            }
+            pcap = want;
+        }
+        int np = 0;
+        pfd[np++] = (struct pollfd){ wake, POLLIN, 0 };
+        for (int i = head; i < next; i++) {
+            for (int k = 0; k < 2; k++) {
+                if (jobs[i].fd[k] < 0) continue;
+                polled[np] = &jobs[i];
+                pfd[np++] = (struct pollfd){ jobs[i].fd[k], POLLIN, 0 };
+            }
+        }
+        if (np > 1 || running > 0) {
+            if (poll(pfd, (nfds_t)np, wake >= 0 ? -1 : 10) < 0 && errno != EINTR) {
+                perror("poll");
+                break;
+            }
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            char buf[64];
+            while (read(wake, buf, sizeof(buf)) > 0) {}
+        }
+        // reap whatever exited; a SIGCHLD since the poll leaves a byte for the next
+        for (int i = head; i < next; i++) {
+            if (jobs[i].pid <= 0 || waitpid(jobs[i].pid, &jobs[i].status, WNOHANG) <= 0) continue;
+            jobs[i].pid = -1;
+            running--;
+        }
+
+        for (int p = 1; p < np; p++) {
+            if (!pfd[p].revents) continue;
+            pjob *j = polled[p];
+            int k = j->fd[0] == pfd[p].fd ? 0 : 1;
+            char buf[65536];
+            ssize_t n = read(pfd[p].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                close(j->fd[k]);
+                j->fd[k] = -1;
+            } else if (j == &jobs[head]) {
+                write_all(k + 1, buf, (size_t)n);
+            } else if (hold(&j->held[k], buf, (size_t)n) != 0) {
+                perror("parallel");
+            }
+        }
+
+        while (head < nargs && finished(&jobs[head])) {
+            release(&jobs[head]);
+            int st = jobs[head].status;
+            if (!WIFEXITED(st) || WEXITSTATUS(st) != 0) failed++;
+            head++;
+            if (head < next) release(&jobs[head]);
+        }
+    }
+    rc = failed > 101 ? 101 : failed;
+
+out:
+    for (int i = 0; jobs && i < nargs; i++) {
+        for (int k = 0; k < 2; k++) {
+            if (jobs[i].fd[k] >= 0) close(jobs[i].fd[k]);
+            free(jobs[i].held[k].data);
+        }
+        if (jobs[i].pid > 0) waitpid(jobs[i].pid, NULL, 0);
+    }
+    if (r.devnull >= 0) close(r.devnull);
+    free(r.path);
+    free(jobs);
+    free(pfd);
+    free(polled);
+    for (int i = 0; lines && i < nargs; i++) free(lines[i]);
+    free(lines);
+    return rc;
+}
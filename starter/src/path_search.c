@@ -1,50 +1,421 @@
 #define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include "path_search.h"
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
 
-char* search_path(char *command_name) {
-    if (strchr(command_name, '/')) {
-        if (access(command_name, X_OK) == 0) {
-            return strdup(command_name);
+#define HASH_INIT_BUCKETS 64
+
+/* Command-location cache, like bash's `hash`: bare command name -> the
+ * absolute path a PATH walk found for it. The whole table is dropped when
+ * PATH changes, and a single entry is dropped when its file stops being
+ * executable, so a hit costs one access() instead of one per directory. */
+typedef struct path_entry {
+    char *name;
+    char *path;
+    unsigned hits;
+    struct path_entry *next;
+} path_entry;
+
+static path_entry **buckets;
+static size_t nbuckets;
+static size_t nentries;
+static char *hashed_path_env;   // PATH value the table was built against
+
+static size_t hash_name(const char *s) {
+    size_t h = 2166136261u;     // FNV-1a
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void free_entry(path_entry *e) {
+    free(e->name);
+    free(e->path);
+    free(e);
+}
+
+void path_hash_clear(void) {
+    for (size_t b = 0; b < nbuckets; b++) {
+        path_entry *e = buckets[b];
+        while (e) {
+            path_entry *next = e->next;
+            free_entry(e);
+            e = next;
         }
-        return NULL; //if not executable, return NULL
+        buckets[b] = NULL;
     }
-    char *path = getenv("PATH");
-    if (!path) {
-        path = "/bin:/usr/bin";
+    nentries = 0;
+}
+
+static const char *current_path_env(void) {
+    const char *path = getenv("PATH");
+    return path ? path : "/bin:/usr/bin";
+}
+
+//drop everything if PATH changed since the table was filled
+static void check_path_env(void) {
+    const char *path = current_path_env();
+    if (hashed_path_env && strcmp(hashed_path_env, path) == 0) return;
+    path_hash_clear();
+    free(hashed_path_env);
+    hashed_path_env = strdup(path);
+}
+
+static void grow_buckets(void) {
+    size_t n = nbuckets ? nbuckets * 2 : HASH_INIT_BUCKETS;
+    path_entry **nb = calloc(n, sizeof(*nb));
+    if (!nb) return;
+    for (size_t b = 0; b < nbuckets; b++) {
+        path_entry *e = buckets[b];
+        while (e) {
+            path_entry *next = e->next;
+            size_t i = hash_name(e->name) & (n - 1);
+            e->next = nb[i];
+            nb[i] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = nb;
+    nbuckets = n;
+}
+
+static path_entry **find_slot(const char *cmd) {
+    path_entry **pp = &buckets[hash_name(cmd) & (nbuckets - 1)];
+    while (*pp && strcmp((*pp)->name, cmd) != 0) pp = &(*pp)->next;
+    return pp;
+}
+
+static void remove_entry(const char *cmd) {
+    path_entry **pp = find_slot(cmd);
+    if (*pp) {
+        path_entry *e = *pp;
+        *pp = e->next;
+        free_entry(e);
+        nentries--;
+    }
+}
+
+//walk PATH without copying it; returns a malloc'd path or NULL
+static char *walk_path(const char *cmd) {
+    const char *dir = current_path_env();
+    size_t cl = strlen(cmd);
+    char full_path[PATH_MAX];
+
+    while (*dir) {
+        const char *end = strchr(dir, ':');
+        size_t dl = end ? (size_t)(end - dir) : strlen(dir);
+        if (dl > 0 && dl + 1 + cl < sizeof(full_path)) {
+            memcpy(full_path, dir, dl);
+            full_path[dl] = '/';
+            memcpy(full_path + dl + 1, cmd, cl + 1);
+            if (access(full_path, X_OK) == 0) return strdup(full_path);
+        }
+        if (!end) break;
+        dir = end + 1;
     }
+    return NULL;
+}
 
-    char *path_copy = strdup(path);
-    if (!path_copy) {
+static path_entry *insert_entry(const char *cmd, char *path, unsigned hits) {
+    if (nentries >= nbuckets) grow_buckets();
+    if (!nbuckets) return NULL;
+    path_entry *e = malloc(sizeof(*e));
+    if (!e) return NULL;
+    e->name = strdup(cmd);
+    e->path = path;
+    e->hits = hits;
+    if (!e->name) {
+        free(e);
         return NULL;
     }
-     
-    char *directory = strtok(path_copy, ":"); //split path b colon to get each directory
-    char *full_path = malloc(PATH_MAX); //allocate memory for full path
-    if (!full_path) {
-        free(path_copy);
+    path_entry **pp = &buckets[hash_name(cmd) & (nbuckets - 1)];
+    e->next = *pp;
+    *pp = e;
+    nentries++;
+    return e;
+}
+
+const char *path_hash_lookup(const char *cmd) {
+    if (!cmd || !*cmd) return NULL;
+    if (strchr(cmd, '/')) {
+        return access(cmd, X_OK) == 0 ? cmd : NULL;
+    }
+
+    check_path_env();
+    if (nbuckets) {
+        path_entry *e = *find_slot(cmd);
+        if (e) {
+            if (access(e->path, X_OK) == 0) {
+                e->hits++;
+                return e->path;
+            }
+            remove_entry(cmd);  // stale: binary moved or deleted
+        }
+    }
+
+    char *path = walk_path(cmd);
+    if (!path) return NULL;
+    path_entry *e = insert_entry(cmd, path, 1);
+    if (!e) {
+        free(path);
         return NULL;
     }
-    
-    while (directory != NULL) {
-        snprintf(full_path, PATH_MAX, "%s/%s", directory, command_name); 
-        
-        if (access(full_path, X_OK) == 0) {
-            free(path_copy);  
-            return full_path;
+    return e->path;
+}
+
+//`hash name`: (re)hash a command without running it
+int path_hash_add(const char *cmd) {
+    if (!cmd || !*cmd || strchr(cmd, '/')) return -1;
+    check_path_env();
+    if (nbuckets) remove_entry(cmd);
+    char *path = walk_path(cmd);
+    if (!path) return -1;
+    if (!insert_entry(cmd, path, 0)) {
+        free(path);
+        return -1;
+    }
+    return 0;
+}
+
+void path_hash_print(void) {
+    check_path_env();
+    if (nentries == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (size_t b = 0; b < nbuckets; b++) {
+        for (path_entry *e = buckets[b]; e; e = e->next) {
+            printf("%4u\t%s\n", e->hits, e->path);
         }
-        
-        directory = strtok(NULL, ":"); //get next directory
     }
-    
-    free(path_copy);
-    free(full_path);
-    return NULL;
 }
+
+char* search_path(char *command_name) {
+    const char *path = path_hash_lookup(command_name);
+    return path ? strdup(path) : NULL; //caller frees, as before
+}
+
+/* Executable index for command completion. Each PATH directory is listed
+ * once into a sorted name array and kept with the directory's mtime.
+ * A completion only stat()s the directories and re-lists the ones whose
+ * mtime moved, so Tab never readdir()s PATH while nothing has changed,
+ * and a prefix is a binary search per directory.
+ */
+typedef struct {
+    char   *dir;
+    struct timespec mtime;
+    int     listed;
+    char   *names;          // NUL-separated
+    size_t  names_used, names_cap;
+    char  **sorted;
+    size_t  n, cap;
+} path_dir;
+
+static path_dir *pdirs;
+static size_t    npdirs;
+static char     *indexed_path_env;
+static char    **matches;
+static size_t    matches_cap;
+
+static void free_dirs(void) {
+    for (size_t i = 0; i < npdirs; i++) {
+        free(pdirs[i].dir);
+        free(pdirs[i].names);
+        free(pdirs[i].sorted);
+    }
+    free(pdirs);
+    pdirs = NULL;
+    npdirs = 0;
+}
+
+//one slot per distinct non-empty PATH component, unlisted
+static void index_path_env(void) {
+    const char *path = current_path_env();
+    if (indexed_path_env && strcmp(indexed_path_env, path) == 0) return;
+    free_dirs();
+    free(indexed_path_env);
+    indexed_path_env = strdup(path);
+
+    size_t cap = 1;
+    for (const char *c = path; *c; c++) cap += *c == ':';
+    pdirs = calloc(cap, sizeof(*pdirs));
+    if (!pdirs) return;
+    for (const char *dir = path; ; ) {
+        const char *end = strchr(dir, ':');
+        size_t dl = end ? (size_t)(end - dir) : strlen(dir);
+        int dup = dl == 0;
+        for (size_t i = 0; i < npdirs && !dup; i++) {
+            dup = strlen(pdirs[i].dir) == dl && strncmp(pdirs[i].dir, dir, dl) == 0;
+        }
+        if (!dup && (pdirs[npdirs].dir = strndup(dir, dl)) != NULL) npdirs++;
+        if (!end) break;
+        dir = end + 1;
+    }
+}
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void list_dir(path_dir *d) {
+    d->names_used = d->n = 0;
+    d->listed = 1;
+    DIR *dp = opendir(d->dir);
+    if (!dp) return;
+    int dfd = dirfd(dp);
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        if (de->d_name[0] == '.' && (!de->d_name[1] || (de->d_name[1] == '.' && !de->d_name[2]))) continue;
+        struct stat st;
+        if (fstatat(dfd, de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111)) continue;
+        size_t len = strlen(de->d_name) + 1;
+        if (d->names_used + len > d->names_cap) {
+            size_t cap = d->names_cap ? d->names_cap * 2 : 4096;
+            while (cap < d->names_used + len) cap *= 2;
+            char *tmp = realloc(d->names, cap);
+            if (!tmp) break;
+            d->names = tmp;
+            d->names_cap = cap;
+        }
+        memcpy(d->names + d->names_used, de->d_name, len);
+        d->names_used += len;
+        d->n++;
+    }
+    closedir(dp);
+
+    if (d->n > d->cap) {
+        char **tmp = realloc(d->sorted, d->n * sizeof(*tmp));
+        if (!tmp) {
+            d->n = 0;
+            return;
+        }
+        d->sorted = tmp;
+        d->cap = d->n;
+    }
+    // pointers are taken once the arena has stopped moving
+    char *p = d->names;
+    for (size_t i = 0; i < d->n; i++, p += strlen(p) + 1) d->sorted[i] = p;
+    qsort(d->sorted, d->n, sizeof(*d->sorted), cmp_names);
+}
+
+static int add_match(size_t *n, char *name) {
+    if (*n == matches_cap) {
+        size_t cap = matches_cap ? matches_cap * 2 : 64;
+        char **tmp = realloc(matches, cap * sizeof(*tmp));
+        if (!tmp) return -1;
+        matches = tmp;
+        matches_cap = cap;
+    }
+    matches[(*n)++] = name;
+    return 0;
+}
+
+/* Executable names in PATH starting with prefix, sorted and without
+ * duplicates. *out and the names stay valid until the next call.
+ */
+size_t path_complete(const char *prefix, size_t len, char ***out) {
+    index_path_env();
+    size_t n = 0;
+    for (size_t i = 0; i < npdirs; i++) {
+        path_dir *d = &pdirs[i];
+        struct stat st;
+        if (stat(d->dir, &st) != 0) {
+            d->n = 0;
+            d->listed = 0;
+            continue;
+        }
+        if (!d->listed || st.st_mtim.tv_sec != d->mtime.tv_sec || st.st_mtim.tv_nsec != d->mtime.tv_nsec) {
+            d->mtime = st.st_mtim;
+            list_dir(d);
+        }
+
+        size_t lo = 0, hi = d->n;    // first name >= prefix
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (strncmp(d->sorted[mid], prefix, len) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        for (; lo < d->n && strncmp(d->sorted[lo], prefix, len) == 0; lo++) {
+            if (add_match(&n, d->sorted[lo]) != 0) break;
+        }
+    }
+    if (n > 1) {
+        qsort(matches, n, sizeof(*matches), cmp_names);
+        size_t u = 1;
+        for (size_t i = 1; i < n; i++) {
+            if (strcmp(matches[i], matches[u - 1]) != 0) matches[u++] = matches[i];
+        }
+        n = u;
+    }
+    *out = matches;
+    return n;
+}
+
+#ifdef PATH_INDEX_BENCH
+/* Tab-completion cost: the indexed lookup against listing PATH on every
+ * Tab, as a completion without an index would.
+ * Build with: gcc -O2 -DPATH_INDEX_BENCH -Iinclude -o bin/path_index_bench src/path_search.c
+ * Usage: bin/path_index_bench [prefix] [iterations]
+ */
+#include <time.h>
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static size_t naive_complete(const char *prefix, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < npdirs; i++) {
+        DIR *dp = opendir(pdirs[i].dir);
+        if (!dp) continue;
+        struct dirent *de;
+        while ((de = readdir(dp)) != NULL) {
+            struct stat st;
+            if (strncmp(de->d_name, prefix, len) == 0 &&
+                fstatat(dirfd(dp), de->d_name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111)) n++;
+        }
+        closedir(dp);
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    const char *prefix = argc > 1 ? argv[1] : "g";
+    int iters = argc > 2 ? atoi(argv[2]) : 1000;
+    size_t len = strlen(prefix);
+    char **out;
+
+    double t0 = now_us();
+    size_t n = path_complete(prefix, len, &out);
+    double t_build = now_us() - t0;
+
+    t0 = now_us();
+    for (int i = 0; i < iters; i++) path_complete(prefix, len, &out);
+    double t_idx = (now_us() - t0) / iters;
+
+    t0 = now_us();
+    size_t naive = 0;
+    for (int i = 0; i < iters / 10 + 1; i++) naive = naive_complete(prefix, len);
+    double t_naive = (now_us() - t0) / (iters / 10 + 1);
+
+    printf("'%s': %zu matches in %zu PATH dirs; first Tab (builds index) %.0f us, "
+           "indexed %.1f us/Tab, rescanning PATH %.0f us/Tab (%zu)\n",
+           prefix, n, npdirs, t_build, t_idx, t_naive, naive);
+    return 0;
+}
+#endif
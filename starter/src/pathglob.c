@@ -0,0 +1,630 @@
+#define _GNU_SOURCE                 // getdents64
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pathglob.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define GLOB_BUCKETS  64
+#define DENTS_BUF     (256 << 10)   // per getdents64 call: a few calls for 100k names
+
+/* A directory is read with getdents64() into one block of names and
+ * sorted once; every pattern over it until the next pathglob_reset()
+ * then walks that block. Names and matches are sorted as (8-byte prefix key, offset)
+ * pairs by radix passes over the keys, with one scratch array kept from
+ * sort to sort, so sorting neither allocates per name nor calls a
+ * comparator per pair. The order is plain byte order (the C locale).
+ *
+ * A component without metacharacters is not listed, and the literal head
+ * and tail of a pattern component (`app-` and `.log` in `app-*.log`)
+ * are compared first, so only names that could match reach the matcher.
+ */
+
+typedef struct {
+    uint64_t key;           // first 8 bytes, big-endian, zero-padded
+    uint32_t off;           // in the names (or results) block
+    uint16_t len;
+    uint8_t  type;          // d_type
+} gname;
+
+typedef struct glob_dir {
+    char   *path;           // as the pattern spells it, "" for .
+    char   *names;
+    size_t  names_used, names_cap;
+    gname  *v;              // sorted
+    size_t  n, cap;
+    struct glob_dir *next;
+} glob_dir;
+
+static glob_dir **buckets;
+static size_t nbuckets, ndirs;
+static char *dents;
+
+enum { COMP_LITERAL, COMP_PATTERN, COMP_GLOBSTAR };
+
+typedef struct {
+    const char *p;
+    size_t len;
+    int    kind;
+    int    dot;             // starts with a literal '.': may match hidden names
+    size_t head, tail;      // literal bytes before the first and after the last metacharacter
+} gcomp;
+
+static gcomp *comps;
+static size_t ncomp, comp_cap;
+static char   path[PATH_MAX];
+
+// matches of the current pattern
+static char  *results;
+static size_t results_used, results_cap;
+static gname *rv;
+static size_t nr, rv_cap;
+static char **rout;
+static size_t rout_cap;
+
+static size_t hash_path(const char *s) {
+    size_t h = 2166136261u;     // FNV-1a
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint64_t name_key(const char *s, size_t len) {
+    uint64_t k = 0;
+    for (size_t i = 0; i < 8; i++) k = k << 8 | (i < len ? (unsigned char)s[i] : 0u);
+    return k;
+}
+
+static gname *sort_tmp;         // scatter buffer of the radix passes, kept
+static size_t sort_tmp_cap;
+static const char *sort_base;
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(sort_base + ((const gname *)a)->off, sort_base + ((const gname *)b)->off);
+}
+
+// names longer than depth, by their bytes from depth on
+static void insertion_sort(gname *v, size_t n, const char *base, size_t depth) {
+    for (size_t i = 1; i < n; i++) {
+        gname e = v[i];
+        size_t j = i;
+        while (j > 0 && strcmp(base + v[j - 1].off + depth, base + e.off + depth) > 0) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = e;
+    }
+}
+
+/* Byte order of names that agree on their first depth bytes: an LSD
+ * radix sort on the 8-byte keys (a pass is skipped when every key has
+ * the same byte there), then each run of equal keys is sorted the same
+ * way on the next 8 bytes. Names in a run share those 8 bytes; the ones
+ * that end there (`abcdefgh` among `abcdefghz`) go first, the rest are
+ * sorted on. */
+static void sort_names(gname *v, size_t n, const char *base, size_t depth) {
+    if (n < 32) {
+        insertion_sort(v, n, base, depth);
+        return;
+    }
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t count[256] = {0};
+        for (size_t i = 0; i < n; i++) count[(v[i].key >> shift) & 255]++;
+        if (count[(v[0].key >> shift) & 255] == n) continue;
+        for (size_t b = 0, at = 0; b < 256; b++) {
+            size_t c = count[b];
+            count[b] = at;
+            at += c;
+        }
+        for (size_t i = 0; i < n; i++) sort_tmp[count[(v[i].key >> shift) & 255]++] = v[i];
+        memcpy(v, sort_tmp, n * sizeof(*v));
+    }
+    for (size_t i = 0; i < n; ) {
+        size_t j = i + 1;
+        while (j < n && v[j].key == v[i].key) j++;
+        size_t longer = i;      // names that end within the key move ahead of it
+        for (size_t k = i; k < j; k++) {
+            if (v[k].len > depth + 8) continue;
+            gname e = v[k];
+            v[k] = v[longer];
+            v[longer++] = e;
+        }
+        if (j - longer > 1) {
+            for (size_t k = longer; k < j; k++) {
+                v[k].key = name_key(base + v[k].off + depth + 8, v[k].len - depth - 8);
+            }
+            sort_names(v + longer, j - longer, base, depth + 8);
+        }
+        i = j;
+    }
+}
+
+static void sort_block(gname *v, size_t n, const char *base) {
+    if (n > sort_tmp_cap) {
+        gname *tmp = realloc(sort_tmp, n * sizeof(*tmp));
+        if (!tmp) {
+            sort_base = base;
+            qsort(v, n, sizeof(*v), cmp_names);
+            return;
+        }
+        sort_tmp = tmp;
+        sort_tmp_cap = n;
+    }
+    sort_names(v, n, base, 0);
+}
+
+static int push_name(char **block, size_t *used, size_t *cap, gname **v, size_t *n, size_t *vcap,
+                     const char *s, size_t len, unsigned char type) {
+    if (*used + len + 1 > *cap) {
+        size_t c = *cap ? *cap * 2 : 4096;
+        while (c < *used + len + 1) c *= 2;
+        char *tmp = realloc(*block, c);
+        if (!tmp) return -1;
+        *block = tmp;
+        *cap = c;
+    }
+    if (*n == *vcap) {
+        size_t c = *vcap ? *vcap * 2 : 64;
+        gname *tmp = realloc(*v, c * sizeof(*tmp));
+        if (!tmp) return -1;
+        *v = tmp;
+        *vcap = c;
+    }
+    memcpy(*block + *used, s, len);
+    (*block)[*used + len] = '\0';
+    (*v)[(*n)++] = (gname){ name_key(s, len), (uint32_t)*used, (uint16_t)len, type };
+    *used += len + 1;
+    return 0;
+}
+
+static void read_dir(glob_dir *d, int fd) {
+    d->names_used = d->n = 0;
+    if (!dents && !(dents = malloc(DENTS_BUF))) return;
+    ssize_t got;
+    while ((got = getdents64(fd, dents, DENTS_BUF)) > 0) {
+        for (ssize_t off = 0; off < got; ) {
+            struct dirent64 *de = (struct dirent64 *)(dents + off);
+            off += de->d_reclen;
+            const char *s = de->d_name;
+            if (s[0] == '.' && (!s[1] || (s[1] == '.' && !s[2]))) continue;
+            if (push_name(&d->names, &d->names_used, &d->names_cap, &d->v, &d->n, &d->cap,
+                          s, strlen(s), de->d_type) != 0) {
+                return;
+            }
+        }
+    }
+    sort_block(d->v, d->n, d->names);
+}
+
+static void grow_buckets(void) {
+    size_t n = nbuckets ? nbuckets * 2 : GLOB_BUCKETS;
+    glob_dir **nb = calloc(n, sizeof(*nb));
+    if (!nb) return;
+    for (size_t b = 0; b < nbuckets; b++) {
+        glob_dir *d = buckets[b];
+        while (d) {
+            glob_dir *next = d->next;
+            size_t h = hash_path(d->path) & (n - 1);
+            d->next = nb[h];
+            nb[h] = d;
+            d = next;
+        }
+    }
+    free(buckets);
+    buckets = nb;
+    nbuckets = n;
+}
+
+// the listing of dir, read now unless it was read since the last reset
+static glob_dir *listing(const char *dir) {
+    if (ndirs >= nbuckets) grow_buckets();     // ** can list thousands
+    if (!nbuckets) return NULL;
+    size_t b = hash_path(dir) & (nbuckets - 1);
+    glob_dir *d = buckets[b];
+    while (d && strcmp(d->path, dir) != 0) d = d->next;
+    if (d) return d;
+    int fd = open(*dir ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    d = calloc(1, sizeof(*d));
+    if (!d || !(d->path = strdup(dir))) {
+        free(d);
+        close(fd);
+        return NULL;
+    }
+    d->next = buckets[b];
+    buckets[b] = d;
+    ndirs++;
+    read_dir(d, fd);
+    close(fd);
+    return d;
+}
+
+void pathglob_reset(void) {
+    for (size_t b = 0; b < nbuckets; b++) {
+        glob_dir *d = buckets[b];
+        while (d) {
+            glob_dir *next = d->next;
+            free(d->path);
+            free(d->names);
+            free(d->v);
+            free(d);
+            d = next;
+        }
+        buckets[b] = NULL;
+    }
+    ndirs = 0;
+}
+
+// [...] at p (after the '['): the byte after its ']', or NULL if it has none
+static const char *match_class(const char *p, const char *pe, unsigned char c, int *ok) {
+    int neg = p < pe && (*p == '!' || *p == '^');
+    if (neg) p++;
+    int hit = 0;
+    for (const char *first = p; p < pe; ) {
+        if (*p == ']' && p > first) {
+            *ok = hit != neg;
+            return p + 1;
+        }
+        unsigned char lo = (unsigned char)*p++;
+        if (lo == '\\' && p < pe) lo = (unsigned char)*p++;
+        unsigned char hi = lo;
+        if (p + 1 < pe && *p == '-' && p[1] != ']') {
+            hi = (unsigned char)p[1];
+            p += 2;
+            if (hi == '\\' && p < pe) hi = (unsigned char)*p++;
+        }
+        if (c >= lo && c <= hi) hit = 1;
+    }
+    return NULL;
+}
+
+/* One component: `*` remembers where it was and, on a mismatch later,
+ * retries one byte further along the name, so the match is linear
+ * in practice and never recursive. */
+static int match(const char *p, const char *pe, const char *s, const char *se) {
+    const char *star_p = NULL, *star_s = NULL;
+    while (s < se) {
+        int ok = 0;
+        if (p < pe) {
+            const char *next = p + 1;
+            if (*p == '*') {
+                star_p = p + 1;
+                star_s = s;
+                p++;
+                continue;
+            } else if (*p == '?') {
+                ok = 1;
+            } else if (*p == '[' && (next = match_class(p + 1, pe, (unsigned char)*s, &ok)) != NULL) {
+                // ok says whether the class took the byte
+            } else {
+                next = p + 1;
+                if (*p == '\\' && p + 1 < pe) next = ++p + 1;
+                ok = *p == *s;
+            }
+            if (ok) {
+                p = next;
+                s++;
+                continue;
+            }
+        }
+        if (!star_p) return 0;
+        p = star_p;
+        s = ++star_s;
+    }
+    while (p < pe && *p == '*') p++;
+    return p == pe;
+}
+
+static size_t literal_len(const char *p, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++, n++) {
+        if (p[i] == '\\' && i + 1 < len) i++;
+    }
+    return n;
+}
+
+// path + '/' + the component's text (unescaped when literal); (size_t)-1 if too long
+static size_t append(size_t plen, const char *s, size_t len, int unescape) {
+    size_t n = unescape ? literal_len(s, len) : len;
+    size_t sep = plen > 0 && path[plen - 1] != '/';
+    if (plen + sep + n + 1 > sizeof(path)) return (size_t)-1;
+    if (sep) path[plen++] = '/';
+    for (size_t i = 0; i < len; i++) {
+        if (unescape && s[i] == '\\' && i + 1 < len) i++;
+        path[plen++] = s[i];
+    }
+    path[plen] = '\0';
+    return plen;
+}
+
+static void emit(size_t plen) {
+    push_name(&results, &results_used, &results_cap, &rv, &nr, &rv_cap, path, plen, 0);
+}
+
+static int is_dir(const gname *e, int follow) {
+    if (e->type == DT_DIR) return 1;
+    if (e->type != DT_UNKNOWN && (e->type != DT_LNK || !follow)) return 0;
+    struct stat st;
+    return (follow ? stat(path, &st) : lstat(path, &st)) == 0 && S_ISDIR(st.st_mode);
+}
+
+static int candidate(const gcomp *c, const char *name, size_t len) {
+    if (name[0] == '.' && !c->dot) return 0;
+    if (len < c->head + c->tail) return 0;
+    if (memcmp(name, c->p, c->head) != 0) return 0;
+    if (memcmp(name + len - c->tail, c->p + c->len - c->tail, c->tail) != 0) return 0;
+    return match(c->p, c->p + c->len, name, name + len);
+}
+
+// matches of components ci.. below path[0..plen)
+static void walk(size_t plen, size_t ci) {
+    if (ci == ncomp) {
+        if (plen > 0) emit(plen);
+        return;
+    }
+    const gcomp *c = &comps[ci];
+    int last = ci + 1 == ncomp;
+
+    if (c->kind == COMP_LITERAL) {
+        size_t n = plen;
+        if (c->len == 0) {
+            // leading, doubled or trailing slash
+            if (ci == 0 || plen > 0) {
+                if (plen + 2 > sizeof(path)) return;
+                if (plen == 0 || path[plen - 1] != '/') path[n++] = '/';
+                path[n] = '\0';
+            }
+        } else if ((n = append(plen, c->p, c->len, 1)) == (size_t)-1) {
+            return;
+        }
+        struct stat st;
+        if (!last) walk(n, ci + 1);
+        else if (n > 0 && lstat(path, &st) == 0) emit(n);
+        return;
+    }
+
+    path[plen] = '\0';
+    glob_dir *d = listing(path);
+    if (!d) return;
+    if (c->kind == COMP_GLOBSTAR && !last) walk(plen, ci + 1);     // no directory at all
+    for (size_t i = 0; i < d->n; i++) {
+        const gname *e = &d->v[i];
+        const char *name = d->names + e->off;
+        if (c->kind == COMP_GLOBSTAR ? name[0] == '.' : !candidate(c, name, e->len)) continue;
+        size_t n = append(plen, name, e->len, 0);
+        if (n == (size_t)-1) continue;
+        if (c->kind == COMP_GLOBSTAR) {
+            // ** does not follow symbolic links, so it cannot loop
+            if (last) emit(n);
+            if (is_dir(e, 0)) walk(n, ci);
+        } else if (last) {
+            emit(n);
+        } else if (is_dir(e, 1)) {
+            walk(n, ci + 1);
+        }
+    }
+}
+
+// a ] that can close a [ whose text starts at p: a lone [ is literal
+static int class_end(const char *p, const char *pe) {
+    if (p < pe && (*p == '!' || *p == '^')) p++;
+    return p + 1 < pe && memchr(p + 1, ']', (size_t)(pe - p - 1)) != NULL;
+}
+
+static int split(const char *pat) {
+    ncomp = 0;
+    for (const char *p = pat; ; ) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (ncomp == comp_cap) {
+            size_t cap = comp_cap ? comp_cap * 2 : 16;
+            gcomp *tmp = realloc(comps, cap * sizeof(*tmp));
+            if (!tmp) return -1;
+            comps = tmp;
+            comp_cap = cap;
+        }
+        gcomp *c = &comps[ncomp++];
+        *c = (gcomp){ p, len, COMP_LITERAL, p[0] == '.' || (p[0] == '\\' && p[1] == '.'), len, 0 };
+        if (len == 2 && p[0] == '*' && p[1] == '*') {
+            c->kind = COMP_GLOBSTAR;
+        } else {
+            size_t last = len;
+            for (size_t i = 0; i < len; i++) {
+                if (!strchr("*?[]\\", p[i])) continue;
+                if (c->head == len) c->head = i;
+                last = i;
+                if (p[i] == '*' || p[i] == '?' || (p[i] == '[' && class_end(p + i + 1, p + len))) {
+                    c->kind = COMP_PATTERN;
+                }
+                if (p[i] == '\\') last = ++i;
+            }
+            c->tail = last == len ? 0 : len - last - 1;
+        }
+        if (!end) return 0;
+        p = end + 1;
+    }
+}
+
+size_t pathglob(const char *pat, char ***out) {
+    *out = NULL;
+    nr = results_used = 0;
+    if (split(pat) != 0) return 0;
+    // one listing is walked in order; across directories, or with more
+    // after the name (`*/Makefile`), the order is by whole path instead
+    size_t magic = 0, last_magic = 0;
+    for (size_t i = 0; i < ncomp; i++) {
+        if (comps[i].kind != COMP_LITERAL) magic++, last_magic = i;
+    }
+    walk(0, 0);
+    if (nr == 0) return 0;
+    if (magic > 1 || comps[last_magic].kind == COMP_GLOBSTAR || last_magic + 1 < ncomp) {
+        sort_block(rv, nr, results);
+    }
+    if (nr + 1 > rout_cap) {
+        char **tmp = realloc(rout, (nr + 1) * sizeof(*tmp));
+        if (!tmp) return 0;
+        rout = tmp;
+        rout_cap = nr + 1;
+    }
+    for (size_t i = 0; i < nr; i++) rout[i] = results + rv[i].off;
+    rout[nr] = NULL;
+    *out = rout;
+    return nr;
+}
+
+#ifdef PATHGLOB_TEST
+/* Sort checks against strcmp order: names that are a prefix of others at
+ * a key boundary (`abcdefgh` with `abcdefghz`), below and above the
+ * insertion-sort cutoff, and a directory globbed in full.
+ * Build with: gcc -DPATHGLOB_TEST -Iinclude -o bin/pathglob_test src/pathglob.c
+ */
+static int sorted_like_strcmp(const char **names, size_t n) {
+    char *block = NULL;
+    size_t used = 0, cap = 0, vn = 0, vcap = 0;
+    gname *v = NULL;
+    for (size_t i = 0; i < n; i++) {
+        push_name(&block, &used, &cap, &v, &vn, &vcap, names[i], strlen(names[i]), 0);
+    }
+    sort_block(v, vn, block);
+    int ok = vn == n;
+    for (size_t i = 1; ok && i < vn; i++) ok = strcmp(block + v[i - 1].off, block + v[i].off) < 0;
+    free(block);
+    free(v);
+    return ok;
+}
+
+int main(void) {
+    int failed = 0;
+    static const char *small[] = { "abcdefgh", "abcdefghz", "abcdefghy" };
+    if (!sorted_like_strcmp(small, 3)) {
+        printf("FAIL: prefix-only name, insertion sort\n");
+        failed++;
+    }
+
+    // 96 names in runs that share 8 and 16 bytes, each run led by its prefix
+    static const char *stems[] = { "abcdefgh", "abcdefghijklmnop", "zzzzzzzz" };
+    const char *big[96];
+    char buf[96][32];
+    size_t n = 0;
+    for (int k = 0; k < 32; k++) {
+        for (int s = 0; s < 3; s++) {
+            if (k == 0) snprintf(buf[n], sizeof(buf[n]), "%s", stems[s]);
+            else snprintf(buf[n], sizeof(buf[n]), "%s%c%d", stems[s], 'z' - k % 26, k);
+            big[n] = buf[n];
+            n++;
+        }
+    }
+    if (!sorted_like_strcmp(big, n)) {
+        printf("FAIL: prefix-only names, radix sort\n");
+        failed++;
+    }
+
+    char dir[] = "/tmp/pathglob_test.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        perror(dir);
+        return 1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        int fd = open(big[i], O_WRONLY | O_CREAT, 0600);
+        if (fd >= 0) close(fd);
+    }
+    char **out;
+    size_t got = pathglob("abcdefgh*", &out);
+    int ok = got == 64;
+    for (size_t i = 1; ok && i < got; i++) ok = strcmp(out[i - 1], out[i]) < 0;
+    if (!ok) {
+        printf("FAIL: abcdefgh* gave %zu names, or out of order\n", got);
+        failed++;
+    }
+    got = pathglob("*", &out);
+    for (size_t i = 0; i < got; i++) unlink(out[i]);
+    if (chdir("/") == 0) rmdir(dir);
+
+    printf(failed ? "%d failed\n" : "all passed\n", failed);
+    return failed != 0;
+}
+#endif
+
+#ifdef PATHGLOB_BENCH
+/* Patterns over one large directory, as in a log directory: this module
+ * (one listing per line, shared by the patterns) against glob(3), which
+ * reads the directory again for each pattern and sorts with strcoll().
+ * Build with: gcc -O2 -DPATHGLOB_BENCH -Iinclude -o bin/pathglob_bench src/pathglob.c
+ * Usage: bin/pathglob_bench [files] [dir]
+ */
+#include <glob.h>
+#include <time.h>
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int files = argc > 1 ? atoi(argv[1]) : 100000;
+    const char *base = argc > 2 ? argv[2] : "/tmp";
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/pathglob_bench.%d", base, (int)getpid());
+    if (mkdir(dir, 0700) != 0 || chdir(dir) != 0) {
+        perror(dir);
+        return 1;
+    }
+    // shuffled creation order, so the directory is not already sorted
+    for (int i = 0; i < files; i++) {
+        char name[64];
+        int k = (int)(((long long)i * 7919) % files);
+        snprintf(name, sizeof(name), k % 10 ? "app-%06d.log" : "app-%06d.txt", k);
+        int fd = open(name, O_WRONLY | O_CREAT, 0600);
+        if (fd >= 0) close(fd);
+    }
+
+    static const char *pats[] = { "*.log", "app-0001*", "app-??????.txt" };
+    enum { NPATS = sizeof(pats) / sizeof(pats[0]), ROUNDS = 5 };
+    printf("%d files, patterns:", files);
+    for (int p = 0; p < NPATS; p++) printf(" %s", pats[p]);
+    printf("\n");
+
+    double best_libc = 1e30, best_ours = 1e30;
+    size_t n_libc = 0, n_ours = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        double t = now_ms();
+        n_libc = 0;
+        for (int p = 0; p < NPATS; p++) {
+            glob_t g;
+            if (glob(pats[p], 0, NULL, &g) == 0) n_libc += g.gl_pathc;
+            globfree(&g);
+        }
+        t = now_ms() - t;
+        if (t < best_libc) best_libc = t;
+
+        t = now_ms();
+        pathglob_reset();           // a new line: the directory is read once for all three
+        n_ours = 0;
+        for (int p = 0; p < NPATS; p++) {
+            char **out;
+            n_ours += pathglob(pats[p], &out);
+        }
+        t = now_ms() - t;
+        if (t < best_ours) best_ours = t;
+    }
+    printf("glob(3)    %8.2f ms  %zu matches\n", best_libc, n_libc);
+    printf("pathglob   %8.2f ms  %zu matches  (%.1fx)\n", best_ours, n_ours, best_libc / best_ours);
+
+    char **all;
+    size_t n = pathglob("*", &all);
+    for (size_t i = 0; i < n; i++) unlink(all[i]);
+    if (chdir(base) == 0) rmdir(dir);
+    return 0;
+}
+#endif
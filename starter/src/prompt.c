@@ -1,37 +1,160 @@
-#define _POSIX_C_SOURCE 200112L
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "prompt.h"
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
-#ifndef USER_MAX
-#define USER_MAX 256
-#endif
 #ifndef MACHINE_MAX
 #define MACHINE_MAX 256
 #endif
 
-char* get_prompt(){
-    static char prompt[PATH_MAX + USER_MAX + MACHINE_MAX+3];
-    static char cwd[PATH_MAX];
+#define DEFAULT_PS1 "\\u@\\H:\\w> "   // the full gethostname(), as before PS1
+
+/* PS1 is compiled once into segments. User, host and plain text are
+ * resolved at compile time and merged into literal runs, so only the cwd
+ * varies; the prompt is re-rendered when cd changes it and printing is one
+ * write() of the rendered bytes.
+ *   \u user   \h host up to the first '.'   \H full host
+ *   \w cwd    \W last cwd component         \$ '#' for root, else '$'
+ *   \n newline   \\ backslash
+ */
+enum { SEG_TEXT, SEG_CWD, SEG_CWD_BASE };
+
+typedef struct {
+    int    kind;
+    size_t off, len;    // SEG_TEXT: run within lit
+} segment;
+
+static char    *lit;
+static size_t   lit_len, lit_cap;
+static segment *segs;
+static int      nseg, seg_cap;
+static char    *cwd;
+static char    *rendered;
+static size_t   rendered_len, rendered_cap;
+static int      ready;
+
+static int reserve(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) return 0;
+    size_t n = *cap ? *cap : 128;
+    while (n < need) n *= 2;
+    char *tmp = realloc(*buf, n);
+    if (!tmp) return -1;
+    *buf = tmp;
+    *cap = n;
+    return 0;
+}
+
+static segment *add_segment(int kind) {
+    if (nseg == seg_cap) {
+        int cap = seg_cap ? seg_cap * 2 : 8;
+        segment *tmp = realloc(segs, (size_t)cap * sizeof(*tmp));
+        if (!tmp) return NULL;
+        segs = tmp;
+        seg_cap = cap;
+    }
+    segment *s = &segs[nseg++];
+    s->kind = kind;
+    s->off = lit_len;
+    s->len = 0;
+    return s;
+}
+
+static void add_text(const char *text, size_t len) {
+    segment *s = (nseg && segs[nseg - 1].kind == SEG_TEXT) ? &segs[nseg - 1] : add_segment(SEG_TEXT);
+    if (!s || reserve(&lit, &lit_cap, lit_len + len) != 0) return;
+    memcpy(lit + lit_len, text, len);
+    lit_len += len;
+    s->len += len;
+}
+
+static void compile(const char *ps1, const char *user, const char *host) {
+    for (const char *c = ps1; *c; c++) {
+        if (*c != '\\' || !c[1]) {
+            add_text(c, 1);
+            continue;
+        }
+        switch (*++c) {
+        case 'u': add_text(user, strlen(user)); break;
+        case 'h': add_text(host, strcspn(host, ".")); break;
+        case 'H': add_text(host, strlen(host)); break;
+        case 'w': add_segment(SEG_CWD); break;
+        case 'W': add_segment(SEG_CWD_BASE); break;
+        case '$': add_text(geteuid() == 0 ? "#" : "$", 1); break;
+        case 'n': add_text("\n", 1); break;
+        case '\\': add_text("\\", 1); break;
+        default:  add_text(c - 1, 2); break;
+        }
+    }
+}
+
+static void render(void) {
+    const char *dir = cwd ? cwd : "";
+    const char *base = strrchr(dir, '/');
+    base = (base && base[1]) ? base + 1 : dir;
+
+    rendered_len = 0;
+    for (int i = 0; i < nseg; i++) {
+        const char *src;
+        size_t len;
+        if (segs[i].kind == SEG_TEXT) {
+            src = lit + segs[i].off;
+            len = segs[i].len;
+        } else {
+            src = segs[i].kind == SEG_CWD ? dir : base;
+            len = strlen(src);
+        }
+        if (reserve(&rendered, &rendered_cap, rendered_len + len + 1) != 0) return;
+        memcpy(rendered + rendered_len, src, len);
+        rendered_len += len;
+    }
+    if (reserve(&rendered, &rendered_cap, rendered_len + 1) == 0) rendered[rendered_len] = '\0';
+}
+
+void prompt_init(void) {
+    if (ready) return;
+    ready = 1;
 
     const char *user = getenv("USER");
     if (!user) user = "user";
-
     char host[MACHINE_MAX + 1];
-    if (gethostname(host, sizeof(host)) != 0) {
-        strncpy(host, "host", MACHINE_MAX);
-    }
+    if (gethostname(host, sizeof(host)) != 0) strcpy(host, "machine");
+    host[MACHINE_MAX] = '\0';
+
+    const char *ps1 = getenv("PS1");
+    compile(ps1 ? ps1 : DEFAULT_PS1, user, host);
+
+    const char *pwd = getenv("PWD");
+    char buf[PATH_MAX];
+    if (!pwd && getcwd(buf, sizeof(buf))) pwd = buf;
+    prompt_set_cwd(pwd ? pwd : "");
+}
 
+//called by cd; the only thing that changes the rendered prompt
+void prompt_set_cwd(const char *dir) {
+    char *tmp = strdup(dir);
+    if (!tmp) return;
+    free(cwd);
+    cwd = tmp;
+    render();
+}
 
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        snprintf(prompt,sizeof(prompt),"%s@%s:%s",user,host,cwd);
-    } else {
-        snprintf(prompt,sizeof(prompt),">");
+void print_prompt(void) {
+    if (!ready) prompt_init();
+    fflush(stdout);     // keep earlier stdio output ahead of the prompt
+    size_t off = 0;
+    while (off < rendered_len) {
+        ssize_t n = write(STDOUT_FILENO, rendered + off, rendered_len - off);
+        if (n <= 0) break;
+        off += (size_t)n;
     }
+}
 
-    return prompt;
+char *get_prompt(void) {
+    if (!ready) prompt_init();
+    return rendered ? rendered : "";
 }
@@ -0,0 +1,270 @@
+#define _GNU_SOURCE                 // memfd_create, pipe2
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "redir.h"
+
+enum { SAVE_NONE = -1, SAVE_CLOSED = -2 };    // Redir.saved besides a descriptor
+
+static int is_number(const char *s) {
+    if (!*s) return 0;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') return 0;
+    }
+    return 1;
+}
+
+/* One redirection word: [n]<, [n]>, [n]>>, [n]>|, [n]<&m, [n]>&m, [n]<&-,
+ * [n]<<<, &>, &>>, with the target attached or in the next word. `&>f`
+ * (and `>&f` with a non-numeric f) expand to two entries, `>f` and `2>&1`.
+ * Only the first lit bytes of tok were typed unquoted, so `">"` or
+ * `\>f` is not a redirection: the operator has to lie within them.
+ * Returns the number of entries written to out (0: tok is not a
+ * redirection), or -1 after reporting a syntax error. */
+int redir_parse(char *tok, size_t lit, char *next, Redir *out, int *used_next) {
+    char *p = tok;
+    int kind, fd = -1, both = 0;
+    *used_next = 0;
+
+    if (p[0] == '&' && p[1] == '>') {
+        p += 2;
+        kind = REDIR_OUT;
+        if (*p == '>') {
+            kind = REDIR_APPEND;
+            p++;
+        }
+        fd = 1;
+        both = 1;
+    } else {
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p != '<' && *p != '>') return 0;
+        if ((size_t)(p - tok) >= lit) return 0;
+        if (p > tok) {
+            long n = strtol(tok, NULL, 10);
+            if (n > INT_MAX / 2) {
+                fprintf(stderr, "error: %.*s: bad file descriptor\n", (int)(p - tok), tok);
+                return -1;
+            }
+            fd = (int)n;
+        }
+        if (p[0] == '<') {
+            if (p[1] == '<' && p[2] == '<') {
+                kind = REDIR_STRING;
+                p += 3;
+            } else if (p[1] == '<' && lit >= (size_t)(p + 2 - tok)) {
+                fprintf(stderr, "error: here-documents are not supported, use <<<\n");
+                return -1;
+            } else if (p[1] == '&') {
+                kind = REDIR_DUP;
+                p += 2;
+            } else {
+                kind = REDIR_IN;
+                p++;
+            }
+            if (fd < 0) fd = 0;
+        } else {
+            if (p[1] == '>') {
+                kind = REDIR_APPEND;
+                p += 2;
+            } else if (p[1] == '&') {
+                kind = REDIR_DUP;
+                p += 2;
+            } else {
+                kind = REDIR_OUT;
+                p += p[1] == '|' ? 2 : 1;     // no noclobber, so >| is >
+            }
+            if (fd < 0) fd = 1;
+        }
+    }
+
+    if ((size_t)(p - tok) > lit) return 0;
+    char *target = p;
+    if (!*target) {
+        if (!next) {
+            fprintf(stderr, "error: missing %s\n",
+                    kind == REDIR_IN ? "input file" : kind == REDIR_STRING ? "here-string"
+                    : kind == REDIR_DUP ? "file descriptor" : "output file");
+            return -1;
+        }
+        target = next;
+        *used_next = 1;
+    }
+
+    Redir r = { kind, fd, -1, target, -1, SAVE_NONE };
+    if (kind == REDIR_DUP) {
+        if (strcmp(target, "-") == 0) {
+            r.kind = REDIR_CLOSE;
+        } else if (is_number(target)) {
+            r.src = atoi(target);
+        } else if (fd == 1 && p[-1] == '&' && p[-2] == '>' && p - 2 == tok) {
+            r.kind = REDIR_OUT;         // >&file is &>file
+            both = 1;
+        } else {
+            fprintf(stderr, "error: %s: bad file descriptor\n", target);
+            return -1;
+        }
+    }
+    out[0] = r;
+    if (!both) return 1;
+    Redir dup = { REDIR_DUP, 2, 1, NULL, -1, SAVE_NONE };
+    out[1] = dup;
+    return 2;
+}
+
+static int open_input(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror("input file");
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        fprintf(stderr, "error: input is not a regular file\n");
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) perror("open input");
+    return fd;
+}
+
+static int open_output(const char *path, int append) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666);
+    if (fd < 0) perror("open output");
+    return fd;
+}
+
+/* An anonymous in-memory file, close-on-exec; -1 where memfd_create()
+ * is missing. */
+int redir_memfd(const char *name) {
+    return memfd_create(name, MFD_CLOEXEC);
+}
+
+/* Here-string: the word and a newline in a memfd, read from offset 0 like
+ * a file. Without memfd a pipe takes it, as long as it fits without a
+ * reader; no helper process either way. */
+static int open_string(const char *s) {
+    struct iovec iov[2] = {
+        { (void *)s, strlen(s) },
+        { "\n", 1 },
+    };
+    size_t total = iov[0].iov_len + 1;
+    int fd = redir_memfd("here-string");
+    if (fd >= 0) {
+        if (writev(fd, iov, 2) == (ssize_t)total && lseek(fd, 0, SEEK_SET) == 0) return fd;
+        perror("here-string");
+        close(fd);
+        return -1;
+    }
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    fcntl(pfd[1], F_SETFL, O_NONBLOCK);
+    ssize_t n = writev(pfd[1], iov, 2);
+    close(pfd[1]);
+    if (n != (ssize_t)total) {
+        fprintf(stderr, "error: here-string too long\n");
+        close(pfd[0]);
+        return -1;
+    }
+    return pfd[0];
+}
+
+int redir_open(Redir *r, int n) {
+    int maxfd = 2;
+    for (int i = 0; i < n; i++) {
+        r[i].opened = -1;
+        if (r[i].fd > maxfd) maxfd = r[i].fd;
+    }
+    for (int i = 0; i < n; i++) {
+        int fd;
+        switch (r[i].kind) {
+        case REDIR_IN:     fd = open_input(r[i].word); break;
+        case REDIR_OUT:    fd = open_output(r[i].word, 0); break;
+        case REDIR_APPEND: fd = open_output(r[i].word, 1); break;
+        case REDIR_STRING: fd = open_string(r[i].word); break;
+        default:           continue;
+        }
+        // keep it clear of the descriptors being set up, or a later dup2
+        // could overwrite it before it is used (4>a 3<b)
+        if (fd >= 0 && fd <= maxfd) {
+            int moved = fcntl(fd, F_DUPFD_CLOEXEC, maxfd + 1);
+            close(fd);
+            fd = moved;
+            if (fd < 0) perror("fcntl");
+        }
+        if (fd < 0) {
+            redir_close(r, i);
+            return -1;
+        }
+        r[i].opened = fd;
+    }
+    return 0;
+}
+
+void redir_close(Redir *r, int n) {
+    for (int i = 0; i < n; i++) {
+        if (r[i].opened >= 0) close(r[i].opened);
+        r[i].opened = -1;
+    }
+}
+
+int redir_to_launch(const Redir *r, int n, launch_spec *ls) {
+    for (int i = 0; i < n; i++) {
+        int rc;
+        if (r[i].kind == REDIR_DUP) rc = launch_dup2(ls, r[i].src, r[i].fd);
+        else if (r[i].kind == REDIR_CLOSE) rc = launch_close(ls, r[i].fd);
+        else rc = launch_dup2(ls, r[i].opened, r[i].fd);
+        if (rc != 0) return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (r[i].opened >= 0 && launch_close(ls, r[i].opened) != 0) return -1;
+    }
+    return 0;
+}
+
+/* In-process: each target is saved the first time it is redirected and
+ * put back by redir_swap_out(), in reverse order. */
+int redir_swap_in(Redir *r, int n) {
+    for (int i = 0; i < n; i++) {
+        int t = r[i].fd;
+        r[i].saved = SAVE_NONE;
+        int first = 1;
+        for (int j = 0; j < i; j++) {
+            if (r[j].fd == t) first = 0;
+        }
+        if (first) {
+            r[i].saved = fcntl(t, F_DUPFD_CLOEXEC, 10);
+            if (r[i].saved < 0) r[i].saved = errno == EBADF ? SAVE_CLOSED : SAVE_NONE;
+        }
+        int rc = 0;
+        if (r[i].kind == REDIR_DUP) rc = dup2(r[i].src, t);
+        else if (r[i].kind == REDIR_CLOSE) close(t);
+        else rc = dup2(r[i].opened, t);
+        if (rc < 0) {
+            fprintf(stderr, "error: %d: %s\n", r[i].kind == REDIR_DUP ? r[i].src : t, strerror(errno));
+            redir_swap_out(r, i + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void redir_swap_out(Redir *r, int n) {
+    for (int i = n; i-- > 0; ) {
+        if (r[i].saved >= 0) {
+            dup2(r[i].saved, r[i].fd);
+            close(r[i].saved);
+        } else if (r[i].saved == SAVE_CLOSED) {
+            close(r[i].fd);
+        }
+        r[i].saved = SAVE_NONE;
+    }
+}
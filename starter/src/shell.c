@@ -1,19 +1,33 @@
 #define _POSIX_C_SOURCE 200809L 
 #define _XOPEN_SOURCE 700  
 
+#include "ast.h"
+#include "builtins.h"
+#include "history.h"
+#include "jobs.h"
+#include "launch.h"
 #include "lexer.h"
+#include "lineedit.h"
+#include "parallel.h"
+#include "path_search.h"
+#include "pathglob.h"
+#include "prompt.h"
 #include "shell.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifndef PATH_MAX
@@ -21,436 +35,1323 @@
 #endif
 
 
-static void free_token_array(char **tokens, int count) {
-    if (!tokens) return;
-    for (int i = 0; i < count; i++) {
-        free(tokens[i]);
+static int push_word(Pipeline *p, char *w) {
+    if (p->nargv == p->argv_cap) {
+        int cap = p->argv_cap ? p->argv_cap * 2 : 16;
+        char **na = realloc(p->argv, (size_t)cap * sizeof(*na));
+        if (!na) {
+            perror("realloc");
+            return -1;
+        }
+        p->argv = na;
+        p->argv_cap = cap;
     }
+    p->argv[p->nargv++] = w;
+    return 0;
 }
 
-static int is_var_name_char(char c) {
-    return (c=='_') || (c>='0' && c<='9') || (c>='A' && c<='Z') || (c>='a' && c<='z');
+static int push_redir(Pipeline *p, const Redir *r) {
+    if (p->nredir == p->redir_cap) {
+        int cap = p->redir_cap ? p->redir_cap * 2 : 8;
+        Redir *nr = realloc(p->redir, (size_t)cap * sizeof(*nr));
+        if (!nr) {
+            perror("realloc");
+            return -1;
+        }
+        p->redir = nr;
+        p->redir_cap = cap;
+    }
+    p->redir[p->nredir++] = *r;
+    return 0;
 }
 
-static char *expand_token(const char *tok) {
-    if (!tok || !*tok) return strdup(tok ? tok : "");
-
-    if (tok[0] == '~' && (tok[1] == '\0' || tok[1] == '/')) {
-        const char *home = getenv("HOME");
-        if (!home) home = "";
-        size_t hl = strlen(home);
-        size_t tl = strlen(tok);
-        size_t outl = hl + (tok[1] ? (tl - 1) : 0);
-        char *out = (char*)malloc(outl + 1);
-        memcpy(out, home, hl);
-        if (tok[1]) memcpy(out + hl, tok + 1, tl - 1);
-        out[outl] = '\0';
-        return out;
+static Command *push_stage(Pipeline *p) {
+    if (p->ncmd == p->cmd_cap) {
+        int cap = p->cmd_cap ? p->cmd_cap * 2 : 4;
+        Command *nc = realloc(p->cmd, (size_t)cap * sizeof(*nc));
+        if (!nc) {
+            perror("realloc");
+            return NULL;
+        }
+        p->cmd = nc;
+        p->cmd_cap = cap;
     }
+    Command *c = &p->cmd[p->ncmd++];
+    memset(c, 0, sizeof(*c));
+    c->argv_off = p->nargv;
+    c->redir_off = p->nredir;
+    c->subshell = -1;
+    return c;
+}
+
+//empty the pipeline but keep its arenas for the next line
+static void reset_pipeline(Pipeline *p) {
+    p->nargv = 0;
+    p->ncmd = 0;
+    p->nredir = 0;
+    p->background = 0;
+}
 
-    if (tok[0] == '$' && tok[1] != '\0') {
-        for (int i = 1; tok[i]; i++) {
-            if (!is_var_name_char(tok[i])) {
-                return strdup(tok);
+/* One stage's words: redirections go to p->redir, the rest to its argv.
+ * A ( ) stage takes redirections only. */
+static int parse_stage_words(Pipeline *p, Command *cur, char **toks, const span *sp, int ntok) {
+    for (int i = 0; i < ntok; i++) {
+        char *t = toks[i];
+        Redir r[2];
+        int used_next;
+        int nr = redir_parse(t, sp[i].lit, i + 1 < ntok ? toks[i + 1] : NULL, r, &used_next);
+        if (nr < 0) return -1;
+        if (nr > 0) {
+            for (int k = 0; k < nr; k++) {
+                if (push_redir(p, &r[k]) != 0) return -1;
             }
+            cur->nredir += nr;
+            i += used_next;
+            continue;
+        }
+        if (cur->subshell >= 0) {
+            fprintf(stderr, "error: syntax error near '%s'\n", t);
+            return -1;
         }
-        const char *val = getenv(tok + 1);
-        return strdup(val ? val : "");
+        if (push_word(p, t) != 0) return -1;
+        cur->argc++;
     }
+    return push_word(p, NULL);
+}
+
+
+static int interactive;     // prompting, job notices; off for scripts and -c
+static int last_status;     // exit status of the last foreground command
+static pid_t shell_pid;     // tells the shell from a forked builtin stage
+
+/* SIGCHLD only writes a byte to a self-pipe. The REPL polls that pipe next
+ * to its input, so exited or stopped background jobs are reaped in one
+ * batch as soon as they change rather than when the user next presses Enter.
+ */
+static int sigchld_pipe[2] = {-1, -1};
 
-    return strdup(tok);
+static void on_sigchld(int sig) {
+    (void)sig;
+    int saved = errno;
+    ssize_t rc = write(sigchld_pipe[1], "c", 1);   // full pipe: a wakeup is pending anyway
+    (void)rc;
+    errno = saved;
 }
 
-static void print_prompt(void) {
-    const char *user = getenv("USER");
-    const char *pwd  = getenv("PWD");
-    char host[256];
-    if (gethostname(host, sizeof(host)) != 0) strncpy(host, "machine", sizeof(host));
-    if (!user) user = "user";
-    if (!pwd)  pwd  = "";
-    printf("%s@%s:%s> ", user, host, pwd);
-    fflush(stdout);
+static void init_sigchld(void) {
+    if (pipe(sigchld_pipe) != 0) {
+        perror("pipe");
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(sigchld_pipe[i], F_SETFL, fcntl(sigchld_pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    struct sigaction sa = {0};
+    sa.sa_handler = on_sigchld;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
 }
 
-static int resolve_executable(const char *cmd, char *out, size_t out_sz) {
-    if (!cmd || !*cmd) return -1;
+/* parallel's wakeup: the self-pipe, as long as this is the shell. A forked
+ * stage would share that pipe with the shell, which could drain the bytes
+ * meant for it, so the stage gets a pipe of its own for the same handler. */
+static int sigchld_fd(void) {
+    static pid_t owner;
+    if (!owner) owner = shell_pid;
+    if (getpid() != owner) {
+        for (int i = 0; i < 2; i++) {
+            if (sigchld_pipe[i] >= 0) close(sigchld_pipe[i]);
+            sigchld_pipe[i] = -1;
+        }
+        init_sigchld();
+        owner = getpid();
+    }
+    return sigchld_pipe[0];
+}
 
-    if (strchr(cmd, '/')) {
-        if (access(cmd, X_OK) == 0) {
-            strncpy(out, cmd, out_sz - 1);
-            out[out_sz - 1] = '\0';
-            return 0;
+// reader wait hook: block until fd is readable, handling SIGCHLDs meanwhile
+static int wait_for_input(int fd) {
+    struct pollfd pfd[2] = {
+        { fd, POLLIN, 0 },
+        { sigchld_pipe[0], POLLIN, 0 },
+    };
+    for (;;) {
+        if (poll(pfd, sigchld_pipe[0] >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return -1;
+        }
+        if (pfd[1].revents & POLLIN) {
+            char buf[256];
+            while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {}
+            jobs_reap();
+            if (interactive && jobs_pending_notices()) {
+                // notices go above the line being edited, which is then redrawn
+                lineedit_hide();
+                int printed = jobs_print_notices();
+                if (!lineedit_show() && printed > 0) print_prompt();
+            }
         }
-        return -1;
+        if (pfd[0].revents) return 0;
     }
+}
 
-    const char *path = getenv("PATH");
-    if (!path) path = "/bin:/usr/bin";
+static const struct {
+    const char *name;
+    int sig;
+} signames[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+    {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+};
 
-char *paths = strdup(path);
-for (char *dir = strtok(paths, ":"); dir; dir = strtok(NULL, ":")) {
-    size_t need = strlen(dir) + 1 + strlen(cmd) + 1;
-    if (need > out_sz) continue;
-    snprintf(out, out_sz, "%s/%s", dir, cmd);
-    if (access(out, X_OK) == 0) {
-        free(paths);
-        return 0;
+// "9", "KILL" or "SIGKILL" -> signal number, or -1
+static int parse_signal(const char *s) {
+    if (*s >= '0' && *s <= '9') {
+        char *end;
+        long n = strtol(s, &end, 10);
+        return *end || n > SIGRTMAX ? -1 : (int)n;
+    }
+    if (strncmp(s, "SIG", 3) == 0) s += 3;
+    for (size_t i = 0; i < sizeof(signames) / sizeof(signames[0]); i++) {
+        if (strcmp(s, signames[i].name) == 0) return signames[i].sig;
     }
+    return -1;
+}
+
+// "%N" -> live job N, reporting errors as "who: ..."
+static Job *parse_jobspec(const char *arg, const char *who) {
+    char *end;
+    long n = strtol(arg + 1, &end, 10);
+    Job *j = (arg[0] == '%' && *end == '\0') ? job_by_number((int)n) : NULL;
+    if (!j) fprintf(stderr, "%s: %s: no such job\n", who, arg);
+    return j;
 }
-free(paths);
-return -1;
+
+// "123" -> pid (negative for kill's process groups), or 0 if not a number
+static pid_t parse_pid(const char *s) {
+    char *end;
+    errno = 0;
+    long n = strtol(s, &end, 10);
+    return end == s || *end || errno || n != (pid_t)n ? 0 : (pid_t)n;
 }
 
+static int time_all;        // report every foreground pipeline as if prefixed with time
+static int pipe_size;       // capacity for pipeline pipes, 0 = the kernel's default
 
-static void init_pipeline(Pipeline *p) {
-    memset(p, 0, sizeof(*p));
-    p->ncmd = 1;
+static int bi_cd(int argc, char **argv) {
+    if (argc > 2) {
+        fprintf(stderr, "cd: too many arguments\n");
+        return 1;
+    }
+    const char *target = (argc == 1) ? getenv("HOME") : argv[1];
+    if (!target) target = "";
+    if (chdir(target) != 0) {
+        perror("cd");
+        return 1;
+    }
+    char buf[PATH_MAX];
+    if (getcwd(buf, sizeof(buf))) {
+        setenv("PWD", buf, 1);
+        prompt_set_cwd(buf);
+    }
+    return 0;
 }
 
-static int parse_tokens_to_pipeline(char **toks, int ntok, Pipeline *p) {
-    init_pipeline(p);
-    Command *cur = &p->cmd[0];
+static int bi_jobs(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    jobs_print();
+    return 0;
+}
 
-    for (int i = 0; i < ntok; i++) {
-        char *t = toks[i];
+static int bi_hash(int argc, char **argv) {
+    if (argc == 1) {
+        path_hash_print();
+        return 0;
+    }
+    if (strcmp(argv[1], "-r") == 0) {
+        path_hash_clear();
+        return 0;
+    }
+    int rc = 0;
+    for (int i = 1; i < argc; i++) {
+        if (path_hash_add(argv[i]) != 0) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            rc = 1;
+        }
+    }
+    return rc;
+}
 
-        if (strcmp(t, "|") == 0) {
-            if (p->ncmd >= MAX_CMDS) {
-                fprintf(stderr, "error: too many pipes\n");
-                return -1;
-            }
-            p->ncmd++;
-            cur = &p->cmd[p->ncmd - 1];
-            continue;
+static int bi_kill(int argc, char **argv) {
+    int sig = SIGTERM;
+    int i = 1;
+    if (i < argc && argv[i][0] == '-' && argv[i][1]) {
+        sig = parse_signal(argv[i] + 1);
+        if (sig < 0) {
+            fprintf(stderr, "kill: %s: invalid signal\n", argv[i] + 1);
+            return 1;
         }
-        if (strcmp(t, "<") == 0) {
-            if (i + 1 >= ntok) {
-                fprintf(stderr, "error: missing input file\n");
-                return -1;
+        i++;
+    }
+    if (i == argc) {
+        fprintf(stderr, "usage: kill [-SIG] %%job|pid ...\n");
+        return 1;
+    }
+    int rc = 0;
+    for (; i < argc; i++) {
+        pid_t target;
+        Job *j = NULL;
+        if (argv[i][0] == '%') {
+            j = parse_jobspec(argv[i], "kill");
+            if (!j) {
+                rc = 1;
+                continue;
             }
-            cur->in_file = toks[++i];
-            continue;
+            target = -j->pgid;      // every stage of the pipeline
+        } else {
+            target = parse_pid(argv[i]);
         }
-        if (strcmp(t, ">") == 0) {
-            if (i + 1 >= ntok) {
-                fprintf(stderr, "error: missing output file\n");
-                return -1;
-            }
-            cur->out_file = toks[++i];
-            continue;
+        if (target == 0 || kill(target, sig) != 0) {
+            fprintf(stderr, "kill: %s: %s\n", argv[i], target ? strerror(errno) : "invalid target");
+            rc = 1;
+        } else if (j && j->state == JOB_STOPPED && (sig == SIGTERM || sig == SIGHUP)) {
+            kill(target, SIGCONT);  // a stopped job only acts on it once running
         }
-        if (strcmp(t, "&") == 0) {
-            p->background = 1;
+    }
+    return rc;
+}
+
+static int bi_wait(int argc, char **argv) {
+    if (argc == 1) {
+        jobs_wait_all();
+        return 0;
+    }
+    int rc = 0;
+    for (int i = 1; i < argc; i++) {
+        pid_t pid = argv[i][0] == '%' ? 0 : parse_pid(argv[i]);
+        Job *j = argv[i][0] == '%' ? parse_jobspec(argv[i], "wait")
+                                   : pid > 0 ? job_by_pid(pid) : NULL;
+        if (!j) {
+            if (argv[i][0] != '%') {
+                fprintf(stderr, "wait: %s: %s\n", argv[i], pid > 0 ? "not a child of this shell" : "invalid pid");
+            }
+            rc = 127;
             continue;
         }
-        cur->argv[cur->argc++] = t;
+        rc = job_wait(j);
     }
+    return rc;
+}
 
-    for (int c = 0; c < p->ncmd; c++) {
-        p->cmd[c].argv[p->cmd[c].argc] = NULL;
+static int bi_fg_bg(int argc, char **argv) {
+    const char *name = argv[0];
+    if (!jobs_control()) {
+        fprintf(stderr, "%s: no job control\n", name);
+        return 1;
     }
-    return 0;
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [%%job]\n", name);
+        return 1;
+    }
+    Job *j = argc == 2 ? parse_jobspec(argv[1], name) : job_current();
+    if (!j) {
+        if (argc == 1) fprintf(stderr, "%s: no current job\n", name);
+        return 1;
+    }
+    if (name[0] == 'b') return job_background(j);
+    printf("%s\n", job_cmdline(j));
+    fflush(stdout);
+    return job_foreground(j, 1);
 }
 
+static int bi_timing(int argc, char **argv) {
+    if (argc == 1) {
+        printf("timing %s\n", time_all ? "on" : "off");
+        return 0;
+    }
+    if (argc > 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) {
+        fprintf(stderr, "usage: timing [on|off]\n");
+        return 1;
+    }
+    time_all = strcmp(argv[1], "on") == 0;
+    return 0;
+}
 
-static Job jobs[MAX_JOBS];
-static int  next_job_no = 1;
+// pipe capacity in bytes, with an optional k or m suffix; 0 if malformed
+static int parse_size(const char *s) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        v *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        v *= 1024 * 1024;
+        end++;
+    }
+    if (errno || end == s || *end || v < 4096 || v > INT_MAX / 2) return 0;
+    return (int)v;
+}
 
-static void add_job(pid_t pid, const char *cmdline) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (!jobs[i].active) {
-            jobs[i].active = 1;
-            jobs[i].pid = pid;
-            jobs[i].job_no = next_job_no++;
-            strncpy(jobs[i].cmdline, cmdline ? cmdline : "", CMDLINE_MAX - 1);
-            jobs[i].cmdline[CMDLINE_MAX - 1] = '\0';
-            printf("[%d] %d\n", jobs[i].job_no, (int)pid);
-            fflush(stdout);
-            return;
-        }
+static int bi_pipesize(int argc, char **argv) {
+    if (argc == 1) {
+        if (pipe_size) printf("pipesize %dk\n", pipe_size / 1024);
+        else printf("pipesize default\n");
+        return 0;
+    }
+    int size = argc == 2 ? parse_size(argv[1]) : 0;
+    if (argc == 2 && strcmp(argv[1], "default") == 0) {
+        pipe_size = 0;
+        return 0;
     }
-    fprintf(stderr, "warning: job table full\n");
+    if (!size) {
+        fprintf(stderr, "usage: pipesize [bytes[k|m] | default]   (at least 4k)\n");
+        return 1;
+    }
+    pipe_size = size;
+    return 0;
 }
 
-static void reap_finished_jobs(void) {
-    int status;
-    pid_t pid;
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        for (int i = 0; i < MAX_JOBS; i++) {
-            if (jobs[i].active && jobs[i].pid == pid) {
-                jobs[i].active = 0;
-                printf("[%d] + done %s\n", jobs[i].job_no, jobs[i].cmdline);
-                fflush(stdout);
-                break;
+static int bi_history(int argc, char **argv) {
+    unsigned first = history_first(), last = history_last();
+    if (argc == 2 && strcmp(argv[1], "-c") == 0) {
+        history_clear();
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], "-s") == 0) {
+        // entries containing the text, oldest first like the plain listing
+        size_t qlen = strlen(argv[2]), nhits = 0, cap = 0;
+        unsigned *hits = NULL;
+        for (unsigned n = last + 1; (n = history_search(argv[2], qlen, n)) != 0; ) {
+            if (nhits == cap) {
+                cap = cap ? cap * 2 : 64;
+                unsigned *tmp = realloc(hits, cap * sizeof(*tmp));
+                if (!tmp) break;
+                hits = tmp;
             }
+            hits[nhits++] = n;
+        }
+        for (size_t i = nhits; i-- > 0; ) {
+            size_t len;
+            const char *text = history_get(hits[i], &len);
+            printf("%5u  %.*s\n", hits[i], (int)len, text);
+        }
+        free(hits);
+        return nhits ? 0 : 1;
+    }
+    if (argc == 2) {
+        char *end;
+        long n = strtol(argv[1], &end, 10);
+        if (*end != '\0' || n < 0) {
+            fprintf(stderr, "history: %s: numeric argument required\n", argv[1]);
+            return 1;
         }
+        if ((unsigned long)n <= last + 1 - first) first = last + 1 - (unsigned)n;
+    } else if (argc > 2) {
+        fprintf(stderr, "usage: history [-c | -s text | n]\n");
+        return 1;
+    }
+    for (unsigned i = first; i <= last && i >= first; i++) {
+        size_t len;
+        const char *text = history_get(i, &len);
+        printf("%5u  %.*s\n", i, (int)len, text);
     }
+    return 0;
 }
 
-static void print_jobs(void) {
-    int any = 0;
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].active) {
-            any = 1;
-            printf("[%d]+ %d %s\n", jobs[i].job_no, (int)jobs[i].pid,
-                   jobs[i].cmdline);
+// exit [n]: n, or the status of the last command
+static int bi_exit(int argc, char **argv) {
+    int status = last_status;
+    if (argc > 1) {
+        char *end;
+        long n = strtol(argv[1], &end, 10);
+        if (!*argv[1] || *end) {
+            fprintf(stderr, "exit: %s: numeric argument required\n", argv[1]);
+            status = 2;
+        } else {
+            status = (int)(n & 255);
         }
     }
-    if (!any) {
-        printf("no active background processes\n");
+    if (getpid() != shell_pid) {
+        // a forked pipeline stage: leave the child, not the shell
+        fflush(stdout);
+        _exit(status);
     }
+    jobs_hangup_stopped();
+    jobs_wait_all();
+    // a script's output is its own: no history listing after it
+    if (!interactive) exit(status);
+    // the last 3 commands of this session, newest first
+    unsigned count = history_session_count();
+    if (count == 0) {
+        printf("no valid commands in history\n");
+    } else {
+        unsigned last = history_last();
+        for (unsigned i = 0; i < count && i < 3; i++) {
+            size_t len;
+            const char *text = history_get(last - i, &len);
+            printf("%.*s\n", (int)len, text);
+        }
+    }
+    exit(status);
+}
+
+/* Every builtin, in one table: a lone foreground builtin runs in the shell
+ * (so cd and friends change its state), anything else forks for it like an
+ * external command stage. A blocking builtin can wait on input or a slow
+ * reader, so under job control it always runs as a job that ^C and ^Z reach.
+ * A pure one only writes output, so a $(...) of it runs in the shell too.
+ */
+static const struct {
+    const char *name;
+    builtin_fn  fn;
+    int         blocking;
+    int         pure;
+} builtins[] = {
+    {"exit", bi_exit, 0, 0}, {"cd", bi_cd, 0, 0}, {"jobs", bi_jobs, 0, 0}, {"hash", bi_hash, 0, 0},
+    {"kill", bi_kill, 0, 0}, {"wait", bi_wait, 0, 0}, {"fg", bi_fg_bg, 0, 0}, {"bg", bi_fg_bg, 0, 0},
+    {"timing", bi_timing, 0, 0}, {"pipesize", bi_pipesize, 0, 0}, {"history", bi_history, 0, 0},
+    {"cat", builtin_cat, 1, 0}, {"parallel", builtin_parallel, 1, 0},
+    {"echo", builtin_echo, 0, 1}, {"printf", builtin_printf, 0, 1}, {"pwd", builtin_pwd, 0, 1},
+    {"test", builtin_test, 0, 1}, {"[", builtin_test, 0, 1},
+    {"true", builtin_true, 0, 1}, {"false", builtin_false, 0, 1},
+};
+
+#define NBUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+static builtin_fn find_builtin(const char *name, int *blocking) {
+    for (size_t i = 0; i < NBUILTINS; i++) {
+        if (strcmp(name, builtins[i].name) == 0) {
+            if (blocking) *blocking = builtins[i].blocking;
+            return builtins[i].fn;
+        }
+    }
+    return NULL;
+}
+
+// the builtin for stage i, unless its arguments are for the external command
+static builtin_fn stage_builtin(const Pipeline *p, int i, int *blocking) {
+    builtin_fn fn = find_builtin(cmd_argv(p, i)[0], blocking);
+    if (fn == builtin_cat && !builtin_cat_takes(p->cmd[i].argc, cmd_argv(p, i))) return NULL;
+    return fn;
+}
+
+// a stage of bare redirections (`< file | cmd`) is a cat of them
+static char *cat_argv[] = {"cat", NULL};
+static char *subshell_argv[] = {"( )", NULL};
+
+static int stage_argc(const Pipeline *p, int i) {
+    return p->cmd[i].argc ? p->cmd[i].argc : 1;
+}
+
+static char **stage_argv(const Pipeline *p, int i) {
+    if (p->cmd[i].subshell >= 0) return subshell_argv;
+    return p->cmd[i].argc ? cmd_argv(p, i) : cat_argv;
+}
+
+// lone foreground builtin: its redirections are swapped in around the call
+static int run_builtin_here(const Pipeline *p, builtin_fn fn) {
+    Redir *rd = cmd_redir(p, 0);
+    int nrd = p->cmd[0].nredir;
+    if (redir_open(rd, nrd) != 0) return 1;
+    fflush(stdout);
+    int ok = redir_swap_in(rd, nrd) == 0;
+    redir_close(rd, nrd);       // the swapped-in descriptors are copies
+    if (!ok) return 1;
+    int rc = fn(p->cmd[0].argc, cmd_argv(p, 0));
+    fflush(stdout);
+    redir_swap_out(rd, nrd);
+    return rc;
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) + (double)(to->tv_nsec - from->tv_nsec) / 1e9;
 }
 
+static double tv_sec(const struct timeval *tv) {
+    return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
 
-static int is_builtin(const Pipeline *p) {
-    if (p->ncmd != 1 || p->background) return 0;
-    Command const *c = &p->cmd[0];
-    if (c->argc == 0) return 0;
-    return (strcmp(c->argv[0], "exit") == 0) ||
-           (strcmp(c->argv[0], "cd") == 0)   ||
-           (strcmp(c->argv[0], "jobs") == 0);
+static void usage_row(const char *label, double wall, double user, double sys,
+                      const struct rusage *ru, const char *what) {
+    fprintf(stderr, "%-6s %8.3f %8.3f %8.3f %8ldk %7ld %6ld %7ld %6ld  %s\n", label, wall, user, sys,
+            ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw, what);
 }
 
-static int run_builtin(Pipeline *p, char history[][CMDLINE_MAX], int hist_n) {
-    Command *c = &p->cmd[0];
-    const char *name = c->argv[0];
+/* Pipe occupancy for the time report: the shell keeps a read end of each
+ * pipe and, while it waits for the job, samples how many bytes are queued
+ * in it (FIONREAD) every PIPE_SAMPLE_MS. A pipe that is mostly full has a
+ * slow reader, one that is mostly empty a slow writer; the vcsw column
+ * counts the stage's blocking waits, on a pipe or otherwise. The shell's
+ * end goes once the reading stage is reaped, so an upstream writer still
+ * gets EPIPE. */
+#define PIPE_SAMPLE_MS 5
+
+typedef struct {
+    int fd;                     // the shell's read end, -1 once dropped
+    int cap;                    // F_GETPIPE_SZ
+    long samples, full, empty;
+    double fill;                // sum of queued/cap over the samples
+    int max;                    // most bytes seen queued
+} pipe_watch;
+
+static struct {
+    pipe_watch *w;              // one per pipe, n - 1 of them
+    int n;
+    const stage_usage *usage;
+} watch;
 
-    if (strcmp(name, "cd") == 0) {
-        if (c->argc > 2) {
-            fprintf(stderr, "cd: too many arguments\n");
-            return 0;
+static void sample_pipes(void *arg) {
+    (void)arg;
+    for (int k = 0; k < watch.n; k++) {
+        pipe_watch *w = &watch.w[k];
+        if (w->fd < 0) continue;
+        if (watch.usage[k + 1].reaped) {
+            close(w->fd);
+            w->fd = -1;
+            continue;
         }
-        const char *target = (c->argc == 1) ? getenv("HOME") : c->argv[1];
-        if (!target) target = "";
-        if (chdir(target) != 0) {
-            perror("cd");
-            return -1;
+        int queued;
+        if (ioctl(w->fd, FIONREAD, &queued) != 0) continue;
+        w->samples++;
+        w->fill += (double)queued / w->cap;
+        if (queued > w->max) w->max = queued;
+        if (queued == 0) w->empty++;
+        if (queued > w->cap - 4096) w->full++;     // not a page of room left
+    }
+}
+
+static void report_pipes(const pipe_watch *w, int n) {
+    int header = 0;
+    for (int k = 0; k < n; k++) {
+        if (w[k].samples == 0) continue;
+        if (!header) {
+            fprintf(stderr, "%-6s %8s %6s %6s %6s %6s %8s\n",
+                    "pipe", "size", "avg", "max", "full", "empty", "samples");
+            header = 1;
         }
-        char buf[PATH_MAX];
-        if (getcwd(buf, sizeof(buf))) setenv("PWD", buf, 1);
-        return 0;
+        char label[32];
+        snprintf(label, sizeof(label), "%d>%d", k + 1, k + 2);
+        double s = (double)w[k].samples;
+        fprintf(stderr, "%-6s %7dk %5.0f%% %5.0f%% %5.0f%% %5.0f%% %8ld\n", label, w[k].cap / 1024,
+                100 * w[k].fill / s, 100.0 * w[k].max / w[k].cap,
+                100 * w[k].full / s, 100 * w[k].empty / s, w[k].samples);
     }
+}
 
-    if (strcmp(name, "jobs") == 0) {
-        print_jobs();
-        return 0;
+/* time report on stderr: one row per stage from its wait4() rusage, then
+ * the pipeline as a whole. Wall time of the total runs from the first
+ * launch to the last reap; maxrss is the largest stage's, other counts add.
+ * Stages not reaped (the job was stopped) are listed without figures.
+ */
+static void report_usage(const Pipeline *p, const stage_usage *u, int n, const char *cmdline) {
+    struct rusage tot;
+    memset(&tot, 0, sizeof(tot));
+    double user = 0, sys = 0;
+    const struct timespec *last = NULL;
+    fprintf(stderr, "%-6s %8s %8s %8s %9s %7s %6s %7s %6s\n",
+            "stage", "wall", "user", "sys", "maxrss", "minflt", "majflt", "vcsw", "ivcsw");
+    for (int i = 0; i < n; i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "%d", i + 1);
+        if (!u[i].reaped) {
+            fprintf(stderr, "%-6s %8s  %s (stopped)\n", label, "-", stage_argv(p, i)[0]);
+            continue;
+        }
+        const struct rusage *ru = &u[i].ru;
+        double su = tv_sec(&ru->ru_utime), ss = tv_sec(&ru->ru_stime);
+        if (n > 1) usage_row(label, elapsed(&u[i].start, &u[i].end), su, ss, ru, stage_argv(p, i)[0]);
+        user += su;
+        sys  += ss;
+        if (ru->ru_maxrss > tot.ru_maxrss) tot.ru_maxrss = ru->ru_maxrss;
+        tot.ru_minflt += ru->ru_minflt;
+        tot.ru_majflt += ru->ru_majflt;
+        tot.ru_nvcsw  += ru->ru_nvcsw;
+        tot.ru_nivcsw += ru->ru_nivcsw;
+        if (!last || elapsed(last, &u[i].end) > 0) last = &u[i].end;
     }
+    if (last) usage_row("total", elapsed(&u[0].start, last), user, sys, &tot, cmdline);
+}
 
-    if (strcmp(name, "exit") == 0) {
-        for (int i = 0; i < MAX_JOBS; i++) {
-            if (jobs[i].active) {
-                waitpid(jobs[i].pid, NULL, 0);
-                jobs[i].active = 0;
-            }
+/* Without job control the shell runs one data-movement stage itself (a
+ * cat of files, or bare redirections) once the other stages are started,
+ * which saves its fork; the kernel moves the bytes either way (zcopy.c).
+ * Under job control it stays a forked stage, so ^Z stops the whole job
+ * instead of the shell sitting in a copy. Not when the stage would read
+ * the shell's own stdin, which may be the script. */
+static int pump_stage(const Pipeline *p, builtin_fn *fns) {
+    if (p->ncmd < 2 || p->background || jobs_control()) return -1;
+    for (int i = 0; i < p->ncmd; i++) {
+        if (fns[i] != builtin_cat) continue;
+        int argc = stage_argc(p, i);
+        char **argv = stage_argv(p, i);
+        int a = argc > 1 && strcmp(argv[1], "-u") == 0 ? 2 : 1;
+        int reads_stdin = a == argc;
+        for (; a < argc; a++) {
+            if (strcmp(argv[a], "-") == 0) reads_stdin = 1;
         }
-        if (hist_n == 0) {
-            printf("no valid commands in history\n");
-        } else {
-            int count = hist_n < 3 ? hist_n : 3;
-            for (int i = 0; i < count; i++) {
-                printf("%s\n", history[(hist_n - 1 - i) % 3]);
-            }
+        const Redir *rd = cmd_redir(p, i);
+        for (int k = 0; k < p->cmd[i].nredir; k++) {
+            if (rd[k].fd == STDIN_FILENO) reads_stdin = 0;
         }
-        exit(0);
+        return i == 0 && reads_stdin ? -1 : i;
     }
-    return 0;
+    return -1;
 }
 
+// the pump stage, in the shell: its descriptors go onto 0/1 for the copy
+static int run_pump(const Pipeline *p, int i, int in, int out) {
+    Redir io[2];
+    int nio = 0;
+    if (in >= 0)  io[nio++] = (Redir){ REDIR_DUP, STDIN_FILENO, in, NULL, -1, -1 };
+    if (out >= 0) io[nio++] = (Redir){ REDIR_DUP, STDOUT_FILENO, out, NULL, -1, -1 };
+    Redir *rd = cmd_redir(p, i);
+    int nrd = p->cmd[i].nredir;
 
-static int open_input(const char *path) {
-    struct stat st;
-    if (stat(path, &st) != 0) {
-        perror("input file");
-        return -1;
-    }
-    if (!S_ISREG(st.st_mode)) {
-        fprintf(stderr, "error: input is not a regular file\n");
-        return -1;
+    // a reader that exits early must end the copy (EPIPE), not the shell
+    sigset_t pipe_set, old;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipe_set, &old);
+
+    int rc = 1;
+    if (redir_swap_in(io, nio) == 0) {
+        if (redir_swap_in(rd, nrd) == 0) {
+            rc = builtin_cat(stage_argc(p, i), stage_argv(p, i));
+            redir_swap_out(rd, nrd);
+        }
+        redir_swap_out(io, nio);
     }
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) perror("open input");
-    return fd;
+
+    struct timespec zero = {0, 0};
+    while (sigtimedwait(&pipe_set, NULL, &zero) > 0) {}
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return rc;
 }
 
-static int open_output(const char *path) {
-    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-    if (fd < 0) perror("open output");
-    return fd;
+/* What a line is run with: its tokens, command list and current pipeline.
+ * A $(...) runs its command in a context of its own, one level down, so
+ * the line that contains it is left as it was. */
+#define SUBST_MAX_DEPTH 32
+
+typedef struct {
+    linetok     lt;
+    ast         tree;
+    Pipeline    pl;
+    const char *line;
+    int         ok;         // some pipeline of the line was valid: record it
+} exec_ctx;
+
+static exec_ctx ctx_stack[SUBST_MAX_DEPTH];
+static exec_ctx *cx = ctx_stack;    // reused line to line
+static int subshell_body = -1;
+static void run_node(int n);
+
+/* A ( list ) stage, or a list run with &, is a forked copy of the shell
+ * that walks the list's nodes and exits with the last status. Its
+ * pipelines stay in the job's process group. */
+static int run_subshell(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    interactive = 0;
+    jobs_drop_control();
+    run_node(subshell_body);
+    return last_status;
 }
 
-static int run_pipeline(Pipeline *p, const char *cmdline) {
+static int run_pipeline(Pipeline *p, const char *cmdline, int timed) {
     int n = p->ncmd;
-    int pipes[MAX_CMDS - 1][2];
-    pid_t pids[MAX_CMDS];
-    memset(pids, 0, sizeof(pids));
-
-    for (int i = 0; i < n - 1; i++) {
-        if (pipe(pipes[i]) != 0) {
-            perror("pipe");
-            return -1;
-        }
+    int rc = -1;
+    last_status = 1;
+    pid_t *pids  = calloc((size_t)n, sizeof(*pids));
+    char  **paths = calloc((size_t)n, sizeof(*paths));
+    builtin_fn *fns = calloc((size_t)n, sizeof(*fns));
+    // only foreground pipelines are timed; the report follows their wait
+    stage_usage *usage = timed && !p->background ? calloc((size_t)n, sizeof(*usage)) : NULL;
+    pipe_watch *pw = usage && n > 1 ? calloc((size_t)n - 1, sizeof(*pw)) : NULL;
+    for (int k = 0; pw && k < n - 1; k++) pw[k].fd = -1;
+    int size_warned = 0;
+    if (!pids || !paths || !fns) {
+        perror("calloc");
+        goto out;
     }
 
+    // Resolve every stage in the parent so the hash table keeps the result
+    // and a missing command fails before anything is forked.
     for (int i = 0; i < n; i++) {
-        int in_fd = -1, out_fd = -1;
-        if (p->cmd[i].in_file) {
-            in_fd = open_input(p->cmd[i].in_file);
-            if (in_fd < 0) return -1;
+        if (p->cmd[i].subshell >= 0) {
+            fns[i] = run_subshell;
+            continue;
         }
-        if (p->cmd[i].out_file) {
-            out_fd = open_output(p->cmd[i].out_file);
-            if (out_fd < 0) return -1;
+        if (p->cmd[i].argc == 0 && p->cmd[i].nredir == 0) {
+            fprintf(stderr, "error: empty command in pipeline\n");
+            goto out;
         }
-
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork");
-            return -1;
+        if (p->cmd[i].argc == 0) {
+            fns[i] = builtin_cat;
+            continue;
         }
-        if (pid == 0) {
-            if (i > 0) {
-                if (dup2(pipes[i-1][0], STDIN_FILENO) < 0) {
-                    perror("dup2 in");
-                    _exit(127);
-                }
-            }
-            if (in_fd >= 0) {
-                if (dup2(in_fd, STDIN_FILENO) < 0) {
-                    perror("dup2 in file");
-                    _exit(127);
-                }
-            }
-            if (i < n - 1) {
-                if (dup2(pipes[i][1], STDOUT_FILENO) < 0) {
-                    perror("dup2 out");
-                    _exit(127);
-                }
+        if ((fns[i] = stage_builtin(p, i, NULL)) != NULL) continue;
+        paths[i] = search_path(cmd_argv(p, i)[0]);
+        if (!paths[i]) {
+            fprintf(stderr, "command not found: %s\n", cmd_argv(p, i)[0]);
+            last_status = 127;
+            goto out;
+        }
+    }
+
+    fflush(stdout);     // builtin output so far goes ahead of the children's
+    int pump = usage ? -1 : pump_stage(p, fns);
+    int pump_in = -1, pump_out = -1;
+
+    // Pipes are created one stage ahead, so the parent never holds more
+    // than the previous read end plus the current pair, whatever n is.
+    // Under job control a foreground pipeline gets its own group too, and
+    // that group is handed the terminal.
+    int own_group = p->background || jobs_control();
+    int started = 0;
+    int prev_rd = -1;
+    for (int i = 0; i < n; i++) {
+        int pfd[2] = {-1, -1};
+        if (i < n - 1) {
+            int prc = launch_pipe(pfd, pipe_size);
+            if (prc < 0) {
+                perror("pipe");
+                break;
             }
-            if (out_fd >= 0) {
-                if (dup2(out_fd, STDOUT_FILENO) < 0) {
-                    perror("dup2 out file");
-                    _exit(127);
+            if (prc > 0 && !size_warned++) fprintf(stderr, "pipesize: %dk: %s\n", pipe_size / 1024, strerror(errno));
+            if (pw) {
+                pw[i].fd = fcntl(pfd[0], F_DUPFD_CLOEXEC, 10);
+                pw[i].cap = launch_pipe_size(pfd[0]);
+                if (pw[i].cap <= 0 && pw[i].fd >= 0) {
+                    close(pw[i].fd);
+                    pw[i].fd = -1;
                 }
             }
+        }
+        Redir *rd = cmd_redir(p, i);
+        int nrd = p->cmd[i].nredir;
+        if (redir_open(rd, nrd) != 0) {
+            if (pfd[0] >= 0) close(pfd[0]);
+            if (pfd[1] >= 0) close(pfd[1]);
+            break;
+        }
+        if (i == pump) {
+            // the shell runs it after the others are up; keep its ends
+            pump_in = prev_rd;
+            pump_out = pfd[1];
+            prev_rd = pfd[0];
+            continue;
+        }
 
-            for (int k = 0; k < n - 1; k++) {
-                close(pipes[k][0]);
-                close(pipes[k][1]);
-            }
-            if (in_fd  >= 0) close(in_fd);
-            if (out_fd >= 0) close(out_fd);
+        // pipe ends first, then the stage's own redirections over them
+        launch_spec ls;
+        launch_spec_init(&ls);
+        if (own_group) ls.pgid = started == 0 ? 0 : pids[0];    // one group per job
+        if (own_group && !p->background) ls.tty_fd = STDIN_FILENO;
+        int acts = 0;   // nonzero once an action could not be recorded
+        if (prev_rd >= 0) acts |= launch_dup2(&ls, prev_rd, STDIN_FILENO);
+        if (pfd[1] >= 0)  acts |= launch_dup2(&ls, pfd[1], STDOUT_FILENO);
+        if (prev_rd >= 0) acts |= launch_close(&ls, prev_rd);
+        if (pfd[0] >= 0)  acts |= launch_close(&ls, pfd[0]);
+        if (pfd[1] >= 0)  acts |= launch_close(&ls, pfd[1]);
+        if (pump_in >= 0)  acts |= launch_close(&ls, pump_in);      // or EOF never comes
+        if (pump_out >= 0) acts |= launch_close(&ls, pump_out);
+        for (int k = 0; fns[i] && pw && k <= i && k < n - 1; k++) {
+            if (pw[k].fd >= 0) acts |= launch_close(&ls, pw[k].fd);    // no exec to drop it
+        }
+        int set_up = acts == 0 && redir_to_launch(rd, nrd, &ls) == 0;
 
-            char path[PATH_MAX];
-            if (resolve_executable(p->cmd[i].argv[0], path, sizeof(path)) != 0) {
-                fprintf(stderr, "command not found: %s\n", p->cmd[i].argv[0]);
-                _exit(127);
-            }
+        if (usage) clock_gettime(CLOCK_MONOTONIC, &usage[i].start);
+        pid_t pid = -1;
+        if (set_up) {
+            subshell_body = p->cmd[i].subshell;
+            pid = fns[i] ? launch_function(fns[i], stage_argc(p, i), stage_argv(p, i), &ls)
+                         : launch_process(paths[i], cmd_argv(p, i), &ls);
+        }
+        launch_spec_free(&ls);
+        if (prev_rd >= 0) close(prev_rd);
+        if (pfd[1] >= 0)  close(pfd[1]);
+        redir_close(rd, nrd);
+        prev_rd = pfd[0];
+        if (pid < 0) break;
+        pids[started++] = pid;
+    }
+    if (prev_rd >= 0) close(prev_rd);
 
-            execv(path, p->cmd[i].argv);
-            perror("execv");
-            _exit(127);
-        } else {
-            pids[i] = pid;
-            if (in_fd  >= 0) close(in_fd);
-            if (out_fd >= 0) close(out_fd);
+    int expected = pump >= 0 ? n - 1 : n;
+    int pump_rc = 1;
+    if (pump >= 0) {
+        if (started == expected) pump_rc = run_pump(p, pump, pump_in, pump_out);
+        if (pump_in >= 0)  close(pump_in);
+        if (pump_out >= 0) close(pump_out);
+        redir_close(cmd_redir(p, pump), p->cmd[pump].nredir);
+    }
+
+    if (started == 0) goto out;
+    if (started == expected) rc = 0;
+
+    // The foreground job is waited for through the table, so a Ctrl-Z
+    // leaves it there as a stopped job; a partial pipeline is waited for
+    // the same way before the error is reported.
+    int bg = p->background && started == expected;
+    Job *j = job_add(own_group ? pids[0] : 0, pids, started, cmdline, !bg);
+    if (bg) goto out;
+    if (j) {
+        j->usage = usage;
+        if (pw) {
+            watch.w = pw;
+            watch.n = started == n ? n - 1 : 0;
+            watch.usage = usage;
+            jobs_set_tick(sample_pipes, NULL, PIPE_SAMPLE_MS);
         }
+        int status = job_foreground(j, 0);
+        jobs_set_tick(NULL, NULL, 0);
+        if (rc == 0) last_status = pump == n - 1 ? pump_rc : status;
+        if (usage) {
+            report_usage(p, usage, started, cmdline);
+            if (pw) report_pipes(pw, n - 1);
+            j->usage = NULL;    // a stopped job outlives this call
+        }
+    } else {
+        int status = 0;
+        for (int i = 0; i < started; i++) waitpid(pids[i], &status, 0);
+        if (rc == 0) last_status = pump == n - 1 ? pump_rc
+                                 : WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
     }
 
-    for (int i = 0; i < n - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+out:
+    if (paths) {
+        for (int i = 0; i < n; i++) free(paths[i]);
+    }
+    free(paths);
+    free(fns);
+    free(pids);
+    free(usage);
+    for (int k = 0; pw && k < n - 1; k++) {
+        if (pw[k].fd >= 0) close(pw[k].fd);
     }
+    free(pw);
+    return rc;
+}
 
-    if (p->background) {
-        add_job(pids[n - 1], cmdline);
-        return 0;
+
+// the pipeline in cx->pl: in the shell, as a bare redirection, or as jobs
+static void run_prepared(const char *text, int timed) {
+    // A lone foreground builtin runs in the shell; in a pipeline or in the
+    // background it is a forked stage like any other
+    builtin_fn fn = NULL;
+    int blocking = 0;
+    Pipeline *p = &cx->pl;
+    if (p->ncmd == 1 && !p->background && p->cmd[0].argc > 0) fn = stage_builtin(p, 0, &blocking);
+    if (fn && blocking && jobs_control()) fn = NULL;
+    if (fn) {
+        // a builtin runs in the shell itself: time it by the shell's own usage
+        stage_usage u;
+        struct rusage before;
+        if (timed == 2) {
+            getrusage(RUSAGE_SELF, &before);
+            clock_gettime(CLOCK_MONOTONIC, &u.start);
+        }
+        last_status = run_builtin_here(p, fn);
+        if (timed == 2) {
+            clock_gettime(CLOCK_MONOTONIC, &u.end);
+            getrusage(RUSAGE_SELF, &u.ru);
+            u.ru.ru_minflt -= before.ru_minflt;
+            u.ru.ru_majflt -= before.ru_majflt;
+            u.ru.ru_nvcsw  -= before.ru_nvcsw;
+            u.ru.ru_nivcsw -= before.ru_nivcsw;
+            u.ru.ru_utime.tv_sec  -= before.ru_utime.tv_sec;
+            u.ru.ru_utime.tv_usec -= before.ru_utime.tv_usec;
+            u.ru.ru_stime.tv_sec  -= before.ru_stime.tv_sec;
+            u.ru.ru_stime.tv_usec -= before.ru_stime.tv_usec;
+            u.reaped = 1;
+            report_usage(p, &u, 1, text);
+        }
+        cx->ok = 1;
+        return;
     }
 
-    for (int i = 0; i < n; i++) {
-        int status;
-        if (waitpid(pids[i], &status, 0) < 0) perror("waitpid");
+    // Bare redirections: files are created or truncated, nothing runs
+    if (p->ncmd == 1 && p->cmd[0].argc == 0 && p->cmd[0].subshell < 0) {
+        if (p->cmd[0].nredir == 0) return;
+        Redir *rd = cmd_redir(p, 0);
+        last_status = redir_open(rd, p->cmd[0].nredir) == 0 ? 0 : 1;
+        redir_close(rd, p->cmd[0].nredir);
+        cx->ok = 1;
+        return;
     }
-    return 0;
+
+    if (run_pipeline(p, text, timed) == 0) cx->ok = 1;
 }
 
+/* An AST_PIPE node: its words are expanded now, not when the line was
+ * read, so they see what the commands before them did; a $(...) in them
+ * runs here too. Expansion can split a word into several fields, so each
+ * stage is parsed from its range of fields. label is the node whose text
+ * names the job (the & node for a background pipeline). */
+static void run_pipe_node(int n, int background, const ast_node *label) {
+    const ast_node *pn = &cx->tree.node[n];
+    Pipeline *p = &cx->pl;
+    reset_pipeline(p);
+    p->background = background;
+    // a command run since the last listing may have changed the directory
+    pathglob_reset();
+    // every stage is expanded before any is parsed: expanding can move the
+    // arena the words point into. Until then a stage's argv_off and argc
+    // hold its range of fields, and its offsets are set in the second pass.
+    cx->lt.nfields = 0;
+    for (int s = pn->left; s >= 0; s = cx->tree.node[s].next) {
+        const ast_node *sn = &cx->tree.node[s];
+        Command *c = push_stage(p);
+        if (!c) return;
+        if (sn->kind == AST_SUBSHELL) c->subshell = sn->left;
+        long first = expand_words(&cx->lt, (size_t)sn->tok, (size_t)(sn->tok + sn->ntok));
+        if (first < 0) {
+            last_status = 1;
+            return;
+        }
+        c->argv_off = (int)first;
+        c->argc = (int)(cx->lt.nfields - (size_t)first);
+    }
+    char **fields = line_fields(&cx->lt);
 
-int main(void) {
-    struct sigaction sa = {0};
-    sa.sa_handler = SIG_IGN;
-    sigaction(SIGINT, &sa, NULL);
+    for (int i = 0; i < p->ncmd; i++) {
+        Command *c = &p->cmd[i];
+        int first = c->argv_off, count = c->argc;
+        c->argv_off = p->nargv;
+        c->argc = 0;
+        c->redir_off = p->nredir;
+        if (parse_stage_words(p, c, fields + first, cx->lt.fields + first, count) != 0) {
+            last_status = 2;
+            return;
+        }
+    }
+    char *text = strndup(cx->line + label->src, label->src_end - label->src);
+    if (!text) {
+        perror("strndup");
+        return;
+    }
+    run_prepared(text, pn->timed ? 2 : time_all);
+    free(text);
+}
 
-    char *line = NULL;
-    size_t cap = 0;
-    char history[3][CMDLINE_MAX] = {{0}};
-    int hist_n = 0;
+// ^C in a foreground job abandons the rest of the line, as in sh
+static int interrupted(void) {
+    return jobs_control() && last_status == 128 + SIGINT;
+}
 
-    for (;;) {
-        reap_finished_jobs();
-        print_prompt();
-
-        ssize_t nread = getline(&line, &cap, stdin);
-        if (nread < 0) {
-            Pipeline dummy = {0};
-            Command c = {0};
-            dummy.cmd[0] = c;
-            dummy.ncmd = 1;
-            char *argv[] = {"exit", NULL};
-            dummy.cmd[0].argv[0] = argv[0];
-            dummy.cmd[0].argc = 1;
-            run_builtin(&dummy, history, hist_n);
-            break;
+static void run_node(int n) {
+    const ast_node *nd = &cx->tree.node[n];
+    switch (nd->kind) {
+    case AST_SEQ:
+        run_node(nd->left);
+        if (!interrupted()) run_node(nd->right);
+        break;
+    case AST_AND:
+        run_node(nd->left);
+        if (last_status == 0) run_node(nd->right);
+        break;
+    case AST_OR:
+        run_node(nd->left);
+        if (last_status != 0 && !interrupted()) run_node(nd->right);
+        break;
+    case AST_BG:
+        if (cx->tree.node[nd->left].kind == AST_PIPE) {
+            run_pipe_node(nd->left, 1, nd);
+        } else {
+            // `a && b &`: the whole list is one background job, a subshell
+            reset_pipeline(&cx->pl);
+            Command *c = push_stage(&cx->pl);
+            if (!c || push_word(&cx->pl, NULL) != 0) return;
+            c->subshell = nd->left;
+            cx->pl.background = 1;
+            char *text = strndup(cx->line + nd->src, nd->src_end - nd->src);
+            if (!text) return;
+            run_prepared(text, 0);
+            free(text);
         }
-        if (nread == 0) continue;
+        break;
+    default:
+        run_pipe_node(n, 0, nd);
+        break;
+    }
+}
 
-        // strip trailing newline
-        if (nread > 0 && line[nread - 1] == '\n') line[nread - 1] = '\0';
-        if (line[0] == '\0') continue;
+static void run_line(const char *line, size_t len) {
+    // Tokenize, then parse the whole line before anything runs
+    int ntok = tokenize_line(&cx->lt, line, len);
+    if (ntok < 0) last_status = 2;
+    if (ntok <= 0) return;
+    int root = ast_parse(&cx->tree, &cx->lt);
+    if (root < 0) {
+        last_status = 2;
+        return;
+    }
 
-        // Tokenize
-        char *raw[MAX_TOKENS] = {0};
-        int ntok = tokenize(line, raw, MAX_TOKENS);
-        if (ntok <= 0) continue;
+    cx->line = line;
+    cx->ok = 0;
+    run_node(root);
+    // recorded into history when some part was a "valid" command
+    if (cx->ok) history_add(line, len);
+}
 
-        // Expand tokens
-        char *toks[MAX_TOKENS] = {0};
-        for (int i = 0; i < ntok; i++) toks[i] = expand_token(raw[i]);
-        free_token_array(raw, ntok);
+/* $(...): the command's output, for the lexer to put in place. The
+ * command is parsed and run one context down. A lone pure builtin runs in
+ * the shell with stdout on a memfd; anything else is a forked subshell
+ * whose output is read from a pipe as it comes, so it never blocks on a
+ * full pipe. Returns NULL (no output) after an error. */
+static int pure_builtin(const char *name) {
+    for (size_t i = 0; i < NBUILTINS; i++) {
+        if (strcmp(name, builtins[i].name) == 0) return builtins[i].pure;
+    }
+    return 0;
+}
 
-        // Parse -> Pipeline
-        Pipeline p;
-        if (parse_tokens_to_pipeline(toks, ntok, &p) != 0) {
-            free_token_array(toks, ntok);
-            continue;
+static char *read_all(int fd, size_t *out_len) {
+    size_t len = 0, cap = 64 << 10;
+    char *buf = malloc(cap);
+    while (buf) {
+        if (len == cap) {
+            char *nb = realloc(buf, cap * 2);
+            if (!nb) break;
+            buf = nb;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            *out_len = len;
+            return buf;
         }
+        len += (size_t)n;
+    }
+    perror("command substitution");
+    free(buf);
+    return NULL;
+}
 
-        // Quick handle built-ins
-        if (is_builtin(&p)) {
-            run_builtin(&p, history, hist_n);
-            // record into history
-            strncpy(history[hist_n % 3], line, CMDLINE_MAX - 1);
-            history[hist_n % 3][CMDLINE_MAX - 1] = '\0';
-            hist_n++;
-            free_token_array(toks, ntok);
-            continue;
+// a subshell writing into a pipe
+static char *capture_forked(int root, size_t *out_len) {
+    int pfd[2];
+    if (pipe(pfd) != 0) {
+        perror("pipe");
+        return NULL;
+    }
+    fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+    launch_spec ls;
+    launch_spec_init(&ls);
+    launch_dup2(&ls, pfd[1], STDOUT_FILENO);
+    launch_close(&ls, pfd[0]);
+    launch_close(&ls, pfd[1]);
+    fflush(stdout);
+    subshell_body = root;
+    pid_t pid = launch_function(run_subshell, 1, subshell_argv, &ls);
+    launch_spec_free(&ls);
+    close(pfd[1]);
+    char *out = pid > 0 ? read_all(pfd[0], out_len) : NULL;
+    close(pfd[0]);
+    int status;
+    if (pid > 0 && waitpid(pid, &status, 0) == pid) {
+        last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    return out;
+}
+
+// a lone pure builtin, in the shell, with stdout on a memfd
+static char *capture_here(int root, size_t *out_len) {
+    int mfd = redir_memfd("command-substitution");
+    if (mfd < 0) return capture_forked(root, out_len);
+    fflush(stdout);
+    int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (saved < 0 || dup2(mfd, STDOUT_FILENO) < 0) {
+        perror("command substitution");
+        if (saved >= 0) close(saved);
+        close(mfd);
+        return NULL;
+    }
+    run_pipe_node(root, 0, &cx->tree.node[root]);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    char *out = lseek(mfd, 0, SEEK_SET) == 0 ? read_all(mfd, out_len) : NULL;
+    close(mfd);
+    return out;
+}
+
+static char *command_output(const char *cmd, size_t len, size_t *out_len) {
+    if (cx == &ctx_stack[SUBST_MAX_DEPTH - 1]) {
+        fprintf(stderr, "error: $(...) nested too deeply\n");
+        return NULL;
+    }
+    cx++;
+    char *out = NULL;
+    *out_len = 0;
+    int ntok = tokenize_line(&cx->lt, cmd, len);
+    int root = ntok > 0 ? ast_parse(&cx->tree, &cx->lt) : -1;
+    if (root >= 0) {
+        cx->line = cx->lt.arena;        // the lexer's copy of cmd
+        const ast_node *rn = &cx->tree.node[root];
+        const ast_node *st = rn->kind == AST_PIPE ? &cx->tree.node[rn->left] : NULL;
+        const span *w = st && st->ntok > 0 ? &cx->lt.spans[st->tok] : NULL;
+        if (st && st->kind == AST_CMD && st->next < 0 && w && w->nexp == 0 && pure_builtin(cx->lt.arena + w->off)) {
+            out = capture_here(root, out_len);
+        } else {
+            out = capture_forked(root, out_len);
+        }
+    } else if (ntok > 0) {
+        last_status = 2;
+    }
+    cx--;
+    pathglob_reset();       // the rest of the words see what it wrote
+    return out;
+}
+
+static void execute_line(const char *line, size_t len) {
+    if (len == 0) return;
+
+    // !!, !n, !-n, !prefix: the expanded line is echoed, run and recorded.
+    // Interactive only, as in bash: a script's `!` is just a character.
+    char *expanded = NULL;
+    if (interactive && memchr(line, '!', len)) {
+        int rc = history_expand(line, len, &expanded, &len);
+        if (rc < 0) {
+            last_status = 1;
+            return;
         }
+        if (rc > 0) {
+            printf("%s\n", expanded);
+            fflush(stdout);
+            line = expanded;
+        }
+    }
+    run_line(line, len);
+    free(expanded);
+}
 
-        // Require command present
-        if (p.cmd[0].argc == 0) {
-            free_token_array(toks, ntok);
-            continue;
+// Wait for background work and leave quietly with the last status
+static void finish_noninteractive(void) {
+    while (waitpid(-1, NULL, 0) > 0) {}
+    exit(last_status);
+}
+
+static const char *timed_source;
+static struct timespec timed_start;
+static long lines_run;
+
+static void report_timing(void) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sec = (double)(end.tv_sec - timed_start.tv_sec) +
+                 (double)(end.tv_nsec - timed_start.tv_nsec) / 1e9;
+    fprintf(stderr, "%s: %ld lines in %.3f s\n", timed_source, lines_run, sec);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: shell [-t] [script | -c command]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    char *command = NULL;
+    const char *script = NULL;
+    int timed = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            if (++i >= argc) usage();
+            command = argv[i];
+        } else if (strcmp(argv[i], "-t") == 0) {
+            timed = 1;
+        } else {
+            usage();
         }
+    }
+    if (!command && i < argc) script = argv[i++];
 
-        // Execute
-        if (run_pipeline(&p, line) == 0) {
-            // record into history as a "valid" command
-            strncpy(history[hist_n % 3], line, CMDLINE_MAX - 1);
-            history[hist_n % 3][CMDLINE_MAX - 1] = '\0';
-            hist_n++;
+    if (script) {
+        int fd = open(script, O_RDONLY);
+        if (fd < 0) {
+            perror(script);
+            return 127;
         }
+        reader_init(fd);
+    }
+    shell_pid = getpid();
+    interactive = !command && !script && isatty(STDIN_FILENO);
+    jobs_set_notify(interactive);
+    history_init(interactive);      // only interactive sessions use the history file
+
+    if (interactive) {
+        // Ctrl-C, Ctrl-Z and friends reach the foreground job, not the shell
+        sigset_t ignored;
+        jobs_init_control(STDIN_FILENO, &ignored);
+        launch_set_sigdefault(&ignored);
+        prompt_init();
+        static const char *names[NBUILTINS + 1];
+        for (size_t k = 0; k < NBUILTINS; k++) names[k] = builtins[k].name;
+        lineedit_set_builtins(names);
+    }
+    launch_init();
+    const char *t = getenv("SHELL_TIMING");
+    time_all = t && *t && strcmp(t, "0") != 0;
+    const char *ps = getenv("SHELL_PIPESIZE");
+    if (ps && *ps && strcmp(ps, "default") != 0 && !(pipe_size = parse_size(ps))) {
+        fprintf(stderr, "warning: bad SHELL_PIPESIZE '%s'\n", ps);
+    }
+    init_sigchld();
+    reader_set_wait(wait_for_input);
+    expand_set_command(command_output);
+    parallel_set_wakeup(sigchld_fd);
+
+    if (timed && !interactive) {
+        timed_source = command ? "-c" : script ? script : "stdin";
+        clock_gettime(CLOCK_MONOTONIC, &timed_start);
+        atexit(report_timing);
+    }
 
-        free_token_array(toks, ntok);
+    if (command) {
+        // one line per newline-separated chunk of the -c string, cut in
+        // place (argv is writable) so each line is a C string like read_line's
+        for (char *s = command; *s; ) {
+            char *nl = strchr(s, '\n');
+            if (nl) *nl = '\0';
+            size_t len = strlen(s);
+            jobs_reap();
+            execute_line(s, len);
+            lines_run++;
+            if (!nl) break;
+            s = nl + 1;
+        }
+        finish_noninteractive();
     }
 
-    free(line);
+    int editing = interactive && lineedit_usable();
+    for (;;) {
+        jobs_reap();
+        if (interactive) jobs_print_notices();
+
+        size_t len;
+        char *line;
+        if (editing) {
+            line = lineedit_read(get_prompt(), &len);
+        } else {
+            if (interactive) print_prompt();
+            line = read_line(&len);
+        }
+        if (!line) {
+            if (!interactive) finish_noninteractive();
+            char *exit_argv[] = {"exit", NULL};
+            bi_exit(1, exit_argv);
+            break;
+        }
+        execute_line(line, len);
+        lines_run++;
+    }
     return 0;
 }
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE                 // splice, copy_file_range
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "zcopy.h"
+
+#define ZCOPY_CHUNK  (1 << 20)      // per splice/sendfile/copy_file_range call
+#define ZCOPY_BUF    (128 << 10)    // read/write fallback
+
+/* Data movement for cat and redirect-only pipeline stages. Each method
+ * works on the descriptors' own offsets, so when one is refused part way
+ * (EINVAL for an unsupported file system, EXDEV, EBADF for an O_APPEND
+ * target of copy_file_range) the next one carries on where it stopped.
+ */
+
+static int refused(int err) {
+    return err == EINVAL || err == ENOSYS || err == EXDEV || err == EBADF ||
+           err == EOPNOTSUPP || err == ESPIPE;
+}
+
+// one method until EOF; *done adds the bytes moved; -1 = refused, -2 = error
+static int run_method(int method, int in, int out, off_t *done) {
+    char *buf = NULL;
+    if (method == ZCOPY_RW && !(buf = malloc(ZCOPY_BUF))) return -2;
+    for (;;) {
+        ssize_t n;
+        switch (method) {
+        case ZCOPY_SPLICE:
+            n = splice(in, NULL, out, NULL, ZCOPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+            break;
+        case ZCOPY_RANGE:
+            n = copy_file_range(in, NULL, out, NULL, ZCOPY_CHUNK, 0);
+            break;
+        case ZCOPY_SENDFILE:
+            n = sendfile(out, in, NULL, ZCOPY_CHUNK);
+            break;
+        default:
+            n = read(in, buf, ZCOPY_BUF);
+            for (ssize_t off = 0; n > 0 && off < n; ) {
+                ssize_t w = write(out, buf + off, (size_t)(n - off));
+                if (w < 0 && errno == EINTR) continue;
+                if (w < 0) {
+                    free(buf);
+                    return -2;
+                }
+                off += w;
+            }
+            break;
+        }
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int err = errno;
+            free(buf);
+            errno = err;
+            return method != ZCOPY_RW && refused(err) ? -1 : -2;
+        }
+        *done += n;
+    }
+    free(buf);
+    return 0;
+}
+
+off_t zcopy_with(int in, int out, int method) {
+    off_t done = 0;
+    int rc = run_method(method, in, out, &done);
+    if (rc == -1) rc = run_method(ZCOPY_RW, in, out, &done);
+    return rc == 0 ? done : -1;
+}
+
+off_t zcopy(int in, int out) {
+    struct stat si, so;
+    if (fstat(in, &si) != 0 || fstat(out, &so) != 0) return -1;
+
+    int order[3], n = 0;
+    if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode)) order[n++] = ZCOPY_SPLICE;
+    if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode)) order[n++] = ZCOPY_RANGE;
+    if (S_ISREG(si.st_mode)) order[n++] = ZCOPY_SENDFILE;
+
+    off_t done = 0;
+    for (int i = 0; i < n; i++) {
+        int rc = run_method(order[i], in, out, &done);
+        if (rc == 0) return done;
+        if (rc == -2) return -1;
+    }
+    return run_method(ZCOPY_RW, in, out, &done) == 0 ? done : -1;
+}
+
+#ifdef ZCOPY_BENCH
+/* Throughput of each copy method for the two shapes a data-movement stage
+ * has: file -> pipe (a reader process drains the pipe with read(), like
+ * the next command of a pipeline would) and file -> file. The file is
+ * read once first so every method runs from the page cache.
+ * Build with: gcc -O2 -DZCOPY_BENCH -Iinclude -o bin/zcopy_bench src/zcopy.c
+ * Usage: bin/zcopy_bench [size_gb] [dir]
+ */
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *method_name[] = { "auto", "read/write", "splice", "copy_file_range", "sendfile" };
+
+static void to_pipe(const char *path, int method, off_t size) {
+    int pfd[2];
+    if (pipe(pfd) != 0) exit(1);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(pfd[1]);
+        static char buf[ZCOPY_BUF];
+        while (read(pfd[0], buf, sizeof(buf)) > 0) {}
+        _exit(0);
+    }
+    close(pfd[0]);
+    int in = open(path, O_RDONLY);
+    double t = now_s();
+    off_t n = zcopy_with(in, pfd[1], method);
+    close(pfd[1]);
+    waitpid(pid, NULL, 0);
+    t = now_s() - t;
+    close(in);
+    printf("file -> pipe  %-16s %6.2f GB/s%s\n", method_name[method], size / t / 1e9,
+           n == size ? "" : "  (short copy)");
+}
+
+static void to_file(const char *path, const char *dst, int method, off_t size) {
+    int in = open(path, O_RDONLY);
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    double t = now_s();
+    off_t n = zcopy_with(in, out, method);
+    t = now_s() - t;
+    close(in);
+    close(out);
+    unlink(dst);
+    printf("file -> file  %-16s %6.2f GB/s%s\n", method_name[method], size / t / 1e9,
+           n == size ? "" : "  (short copy)");
+}
+
+int main(int argc, char **argv) {
+    double gb = argc > 1 ? atof(argv[1]) : 2;
+    const char *dir = argc > 2 ? argv[2] : "/tmp";
+    off_t size = (off_t)(gb * (1 << 30));
+    char path[4096], dst[4096 + 8];
+    snprintf(path, sizeof(path), "%s/zcopy_bench.%d", dir, (int)getpid());
+    snprintf(dst, sizeof(dst), "%s.copy", path);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    char *block = malloc(1 << 20);
+    memset(block, 'x', 1 << 20);
+    for (off_t left = size; left > 0; left -= 1 << 20) {
+        if (write(fd, block, left < (1 << 20) ? (size_t)left : 1 << 20) < 0) {
+            perror("write");
+            return 1;
+        }
+    }
+    close(fd);
+    free(block);
+
+    printf("%.2f GB file in %s\n", gb, dir);
+    to_pipe(path, ZCOPY_RW, size);          // also warms the page cache
+    to_pipe(path, ZCOPY_RW, size);
+    to_pipe(path, ZCOPY_SPLICE, size);
+    to_pipe(path, ZCOPY_SENDFILE, size);
+    to_file(path, dst, ZCOPY_RW, size);
+    to_file(path, dst, ZCOPY_SENDFILE, size);
+    to_file(path, dst, ZCOPY_RANGE, size);
+    unlink(path);
+    return 0;
+}
+#endif
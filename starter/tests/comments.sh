@@ -0,0 +1,8 @@
+#!/bin/sh
+# a script with a shebang and comments runs like any other
+echo one # trailing comment
+    # indented comment line
+echo two;# after an operator
+echo a#b '#quoted' \#escaped "# in quotes"
+
+echo three && echo four # end